@@ -13,6 +13,7 @@
  *  7) Set number of test iterations with -n <int>, for example '-n 20'
  *  8) Use --all to run all tests with a single message and receive results concurrently.
  *     Stacked flags like '-usi' also run tests in parallel with a shared message.
+ *  9) Repeat the test with -c <int>; -w <int> keeps that many tests in flight at once.
  *
  * DATA RETRIEVING
  *  +) Use 'get' and 'export' to retrieve data
@@ -20,21 +21,13 @@
  *  +) 'export' prints to stdout all test data in a csv format (redirect to a file to save)
  */
 
-#include <pthread.h>
-#include <semaphore.h>
-#include <sys/types.h>
-#include <sys/socket.h>
 #include <sys/time.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <time.h>
-#include <netdb.h>
-#include <unistd.h>
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include "tester.h"
 #include "tests_db.h"
 
 /*************************
@@ -42,19 +35,10 @@
  *************************/
 
 #define UUT_ADDR "192.168.1.177"   // IP address of Unit Under Test (UUT)
-#define PORT 54321                 // Port for UDP communication
-#define BUFSIZE 263                // Max possible size of OutMsg
-#define IN_MSG_SIZE 6              // Incoming msg is always 6 bytes
-
-#define TEST_UART 2                // UART test code
-#define TEST_SPI 4                 // SPI test code
-#define TEST_I2C 8                 // I2C test code
-
-#define TEST_SUCCESS 0x01          // Test success code
-#define TEST_FAILED 0xff           // Test failed code
 
 #define N_ITERATIONS 1             // Default number of test iterations
-#define N_TESTS 3                  // Total number of test types
+#define DEFAULT_WINDOW 1           // Default number of tests in flight with -c
+#define LOG_BATCH 256              // Results logged per database transaction with -c
 
 #define ARGS_ERROR 1               // Error parsing command line arguments
 #define UDP_ERROR 2                // UDP communication error
@@ -65,41 +49,21 @@
  *************************/
 
 /**
- * @brief Holds data for outgoing communication
- * 
- * @struct OutMsg
- */
-typedef struct OutMsg
-{
-	uint32_t test_id;              /** Unique test ID */
-	uint8_t peripheral;            /** Peripheral code */
-	uint8_t n_iter;                /** Number of iterations */
-	uint8_t p_len;                 /** Payload length */
-	char payload[256];             /** Payload buffer */
-}OutMsg;
-
-/**
- * @brief Holds data for incoming communication
+ * @brief Totals of a multi-test run, updated by log_result()
  * 
- * @struct InMsg
- */
-typedef struct InMsg
-{
-	uint32_t test_id;              /** Unique test ID */
-    uint8_t peripheral;            /** Peripheral code */
-	uint8_t test_result;           /** Test result (success/fail) */
-}InMsg;
-
-/**
- * @brief Arguments for receiver threads
+ * Results are queued in batch and written with log_tests() once LOG_BATCH
+ * of them have come in.
  * 
- * @struct RecvThreadArgs
+ * @struct RunStats
  */
-typedef struct RecvThreadArgs
+typedef struct RunStats
 {
-    int idx;                       /** Thread index */
-    struct InMsg *recv;            /** Received message data */
-}RecvThreadArgs;
+    unsigned long done;            /** Tests completed */
+    unsigned long failed;          /** Tests that failed or timed out */
+    int log_failed;                /** A result could not be logged */
+    TestRecord batch[LOG_BATCH];   /** Results not logged yet */
+    size_t n_batch;                /** Entries used in batch */
+}RunStats;
 
 /*************************
  * GLOBALS               *
@@ -109,25 +73,6 @@ static const char *DEFAULT_U_MSG = "Hello UART"; /** Default message (bit patter
 static const char *DEFAULT_S_MSG = "Hello SPI";  /** Default message (bit pattern) for SPI test */
 static const char *DEFAULT_I_MSG = "Hello I2C";  /** Default message (bit pattern) for I2C test */
 
-/**
- * Globals for UDP communication
- */
-static int sock;
-static struct sockaddr_in sock_addr;
-static struct hostent *host;
-static char buf[BUFSIZE];
-
-static struct OutMsg out_msg;
-
-/**
- * Globals for multithreading
- */
-static pthread_t threads[N_TESTS];
-static int n_threads = 0;
-static sem_t tests_done_sem;
-static struct InMsg in_msgs[N_TESTS];
-static int results[N_TESTS];
-
 /*************************
  * FUNCTION DECLERATIONS *
  *************************/
@@ -139,59 +84,53 @@ static int results[N_TESTS];
  */
 static void print_usage(const char *progname);
 
-/**
- * @brief Receiver thread function
- * 
- * @param arg Pointer to struct RecvThreadArgs
- * @return void* Always NULL
- */
-static void *recv_thread(void *arg);
-
 /**
  * @brief Perform peripherals test concurrently
  * 
+ * Runs a single test and prints its log, or with count > 1 keeps up to
+ * the tester's window of tests in flight and prints a summary.
+ * 
+ * @param tester Tester context
  * @param peripherals Peripherals code bitfield
  * @param n_iter Number of test iterations
  * @param shared_msg Bit pattern for the test
+ * @param count Number of tests to run
  */
-static void run_parallel_tests(uint8_t peripherals, uint8_t n_iter, const char *shared_msg);
+static void run_parallel_tests(Tester *tester, uint8_t peripherals, uint8_t n_iter,
+                               const char *shared_msg, unsigned long count);
 
 /**
- * @brief Format timestamp into a string
+ * @brief Log a finished test to database (tester_callback)
  * 
- * @param tv Timestamp object
- * @param buffer Destination buffer
- * @param size Size of buffer
+ * @param result Test outcome
+ * @param user Pointer to struct RunStats
  */
-static void format_timestamp(struct timeval *tv, char *buffer, size_t size);
+static void log_result(const TestResult *result, void *user);
 
 /**
- * @brief Get the elapsed seconds between start and end
+ * @brief Log the results queued in a RunStats
  * 
- * @param start Start timestamp
- * @param end End timestamp
- * @return double Elapsed seconds
+ * @param stats Run totals and queued results
  */
-static double get_elapsed_seconds(struct timeval start, struct timeval end);
+static void flush_results(RunStats *stats);
 
 /**
- * @brief Initiates udp network
- * 
- */
-static void udp_init_network();
-
-/**
- * @brief Send OutMsg data via udp socket
+ * @brief Format timestamp into a string
  * 
- * @attention OutMsg must be loaded before calling this function
+ * @param tv Timestamp object
+ * @param buffer Destination buffer
+ * @param size Size of buffer
  */
-static void udp_send_data();
+static void format_timestamp(struct timeval *tv, char *buffer, size_t size);
 
 /**
- * @brief receive udp data and load it to InMsg
+ * @brief Parse a positive integer option value
  * 
+ * @param opt Option name, for the error message
+ * @param val Value string
+ * @return unsigned long Parsed value (exits on error)
  */
-static void udp_receive_data(struct InMsg *in_msg);
+static unsigned long parse_count(const char *opt, const char *val);
 
 /*************************
  * MAIN                  *
@@ -201,11 +140,12 @@ int main(int argc, char *argv[])
 {
     bool want_u = false, want_s = false, want_i = false;
     bool seen_u = false, seen_s = false, seen_i = false;
-    bool used_all = false, used_n = false;
+    bool used_all = false, used_n = false, used_c = false, used_w = false;
     const char *msg_u = NULL, *msg_s = NULL, *msg_i = NULL;
     bool have_msg_u = false, have_msg_s = false, have_msg_i = false;
 
     uint8_t n = N_ITERATIONS;
+    unsigned long count = 1, window = DEFAULT_WINDOW;
 
     if (argc < 2)
     {
@@ -222,7 +162,7 @@ int main(int argc, char *argv[])
             exit(ARGS_ERROR);
         }
 
-        int db_success = init_db();
+        int db_success = db_open();
         if (!db_success)
         {
 	        perror("databse init failed");
@@ -242,6 +182,7 @@ int main(int argc, char *argv[])
 
             print_log_by_id((uint32_t)tid);
         }
+        db_close();
         exit(EXIT_SUCCESS);
     }
     else if (strcmp(argv[1], "export") == 0)
@@ -252,7 +193,7 @@ int main(int argc, char *argv[])
             exit(ARGS_ERROR);
         }
 
-        int db_success = init_db();
+        int db_success = db_open();
         if (!db_success)
         {
 	        perror("databse init failed");
@@ -261,6 +202,7 @@ int main(int argc, char *argv[])
 
         print_all_logs();
 
+        db_close();
         exit(EXIT_SUCCESS);
     }
 
@@ -327,6 +269,28 @@ int main(int argc, char *argv[])
             continue;
         }
 
+        // Handle -c and -w flags
+        if (strcmp(arg, "-c") == 0 || strcmp(arg, "-w") == 0)
+        {
+            bool *used = (arg[1] == 'c') ? &used_c : &used_w;
+            if (*used)
+            {
+                fprintf(stderr, "Error: '%s' cannot be repeated\n", arg);
+                exit(ARGS_ERROR);
+            }
+            if ((idx + 1) >= argc)
+            {
+                fprintf(stderr, "Error: '%s' requires a positive value.\n", arg);
+                exit(ARGS_ERROR);
+            }
+            unsigned long val = parse_count(arg, argv[idx + 1]);
+            if (arg[1] == 'c') count = val;
+            else window = val;
+            *used = true;
+            idx += 2;
+            continue;
+        }
+
         // Handle all other flags
         if (arg[0] == '-' && arg[1] != '\0' && arg[1] != '-')
         {
@@ -402,8 +366,18 @@ int main(int argc, char *argv[])
         msg_i = DEFAULT_I_MSG;
     }
     
-    udp_init_network();
-    int db_success = init_db();
+    if (window > MAX_WINDOW)
+    {
+        fprintf(stderr, "Error: '-w' must be at most %d.\n", MAX_WINDOW);
+        exit(ARGS_ERROR);
+    }
+
+    Tester *tester = tester_create(UUT_ADDR, window);
+    if (!tester)
+    {
+        exit(UDP_ERROR);
+    }
+    int db_success = db_open();
     if (!db_success)
     {
 		perror("databse init failed");
@@ -432,9 +406,11 @@ int main(int argc, char *argv[])
             shared_msg = DEFAULT_U_MSG;
         }
 
-        run_parallel_tests(peripheral_flags, n, shared_msg);
+        run_parallel_tests(tester, peripheral_flags, n, shared_msg, count);
     }
 
+    tester_destroy(tester);
+    db_close();
     return EXIT_SUCCESS;
 }
 
@@ -449,6 +425,8 @@ static void print_usage (const char *progname)
         "       %s [COMMAND]\n"
         "OPTIONS:\n"
         "  -n <int>       Optional: set number (0-255) of test iterations\n"
+        "  -c <int>       Optional: run the test <int> times and print a summary\n"
+        "  -w <int>       Optional: keep up to <int> tests in flight with -c (default 1)\n"
         "  -u [\"msg\"]   Run UART test (with optional message, default if none)\n"
         "  -s [\"msg\"]   Run SPI test (with optional message, default if none)\n"
         "  -i [\"msg\"]   Run I2C test (with optional message, default if none)\n"
@@ -467,180 +445,127 @@ static void print_usage (const char *progname)
     );
 }
 
-static void *recv_thread(void *arg)
+static void run_parallel_tests(Tester *tester, uint8_t peripherals, uint8_t n_iter,
+                               const char *shared_msg, unsigned long count)
 {
-    struct RecvThreadArgs
-    *args = (struct RecvThreadArgs*)arg;
-
-    udp_receive_data(args->recv);
-    results[args->idx] = (args->recv->test_result == TEST_SUCCESS);
-    sem_post(&tests_done_sem);
-
-    free(arg);
-    return NULL;
-}
-
-static void run_parallel_tests(uint8_t peripherals, uint8_t n_iter, const char *shared_msg)
-{
-    int load_success = get_next_id(&out_msg.test_id);
+    uint32_t first_id;
+    int load_success = reserve_ids(&first_id, count);
     if (!load_success)
     {
         perror("loading id from database failed");
         exit(SQLITE_ERROR);
     }
 
-    out_msg.n_iter = n_iter;
-    out_msg.p_len = strlen(shared_msg);
-    strncpy(out_msg.payload, shared_msg, strlen(shared_msg));
-
-    udp_init_network();
-    if (!init_db())
+    size_t p_len = strlen(shared_msg);
+    if (p_len > MAX_PAYLOAD)
     {
-        perror("databse init failed");
-        exit(SQLITE_ERROR);
+        p_len = MAX_PAYLOAD;
     }
 
-    n_threads = 0;
+    if (count == 1)
+    {
+        TestResult result;
+        if (!tester_run(tester, first_id, peripherals, n_iter, shared_msg, p_len, &result))
+        {
+            exit(UDP_ERROR);
+        }
 
-    if (peripherals & TEST_UART) n_threads++;
-    if (peripherals & TEST_I2C) n_threads++;
-    if (peripherals & TEST_SPI) n_threads++;
+        for (int i = 0; i < result.n_replies; ++i)
+        {
+            printf("Test #%d | peripheral %d | result %d\n", result.replies[i].test_id,
+                   result.replies[i].peripheral, result.replies[i].test_result);
+        }
+        if (result.timed_out)
+        {
+            fprintf(stderr, "run_parallel_tests: no reply after %d retransmissions\n", MAX_RETRANSMITS);
+        }
 
-    out_msg.peripheral = peripherals;
+        char timestamp[TIMESTAMP_BUFSIZE];
+        format_timestamp(&result.start, timestamp, sizeof(timestamp));
+        if (!log_test(result.test_id, timestamp, result.duration_sec, result.success))
+        {
+            perror("error logging to database");
+            exit(SQLITE_ERROR);
+        }
 
-    struct timeval start_time, end_time;
+        print_log_by_id(first_id);
+        return;
+    }
 
+    static RunStats stats;         // Holds a whole batch, too big for the stack
+    struct timeval start_time, end_time;
     gettimeofday(&start_time, NULL);
-    udp_send_data();
 
-    sem_init(&tests_done_sem, 0, 0);
-    for (int i = 0; i < n_threads; ++i)
+    for (unsigned long i = 0; i < count; ++i)
     {
-        struct RecvThreadArgs *args = malloc(sizeof(struct RecvThreadArgs));
-        args->idx = i;
-        args->recv = &in_msgs[i];
-        pthread_create(&threads[i], NULL, recv_thread, args);
+        if (!tester_submit(tester, first_id + i, peripherals, n_iter, shared_msg, p_len,
+                           log_result, &stats))
+        {
+            exit(UDP_ERROR);
+        }
     }
-
-    for (int i = 0; i < n_threads; ++i)
-        sem_wait(&tests_done_sem);
-
-    for (int i = 0; i < n_threads; ++i)
-        pthread_join(threads[i], NULL);
+    tester_wait(tester);
+    flush_results(&stats);
 
     gettimeofday(&end_time, NULL);
+    double secs = (double)(end_time.tv_sec - start_time.tv_sec) +
+                  (double)(end_time.tv_usec - start_time.tv_usec) / 1e6;
 
-    char timestamp[64];
-    format_timestamp(&start_time, timestamp, 64);
-    double duration = get_elapsed_seconds(start_time, end_time);
-
-    int all_success = 1;
-    for (int i = 0; i < n_threads; ++i)
-    {
-        if (!results[i])
-        {
-            all_success = 0;
-        } 
-    }
-
-    int log_success = log_test(out_msg.test_id, timestamp, duration, all_success);
-    if(!log_success)
+    if (stats.log_failed)
     {
         perror("error logging to database");
         exit(SQLITE_ERROR);
     }
-
-    print_log_by_id(out_msg.test_id);
-
-    sem_destroy(&tests_done_sem);
+    printf("%lu tests, %lu failed, %.1f tests/s\n", stats.done, stats.failed,
+           secs > 0 ? stats.done / secs : 0);
 }
 
-static void format_timestamp (struct timeval *tv, char *buffer, size_t size)
+static void log_result(const TestResult *result, void *user)
 {
-	struct tm *tm_info = localtime(&tv->tv_sec);
-    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
-}
+    RunStats *stats = user;
+    struct timeval start = result->start;
 
-static double get_elapsed_seconds (struct timeval start, struct timeval end)
-{
-	return (double)(end.tv_sec - start.tv_sec) +
-           (double)(end.tv_usec - start.tv_usec) / 1e6;
+    TestRecord *rec = &stats->batch[stats->n_batch++];
+    rec->test_id = result->test_id;
+    format_timestamp(&start, rec->timestamp, sizeof(rec->timestamp));
+    rec->duration_sec = result->duration_sec;
+    rec->result = result->success;
+
+    stats->done++;
+    if (!result->success)
+    {
+        stats->failed++;
+    }
+    if (stats->n_batch == LOG_BATCH)
+    {
+        flush_results(stats);
+    }
 }
 
-static void udp_init_network ()
+static void flush_results(RunStats *stats)
 {
-    host = (struct hostent *) gethostbyname((char *)UUT_ADDR);
-
-    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    if (stats->n_batch > 0 && !log_tests(stats->batch, stats->n_batch))
     {
-        perror("socket");
-        exit(UDP_ERROR);
+        stats->log_failed = 1;
     }
-
-    sock_addr.sin_family = AF_INET;
-    sock_addr.sin_port = htons(PORT);
-    sock_addr.sin_addr = *((struct in_addr *)host->h_addr);
-    bzero(&(sock_addr.sin_zero),8);
+    stats->n_batch = 0;
 }
 
-static void udp_send_data ()
-{	
-	// load buffer
-	size_t n_bytes = 0;
-	
-	memcpy(&buf[0], &out_msg.test_id, sizeof(int32_t));
-	n_bytes += sizeof(int32_t);
-	
-	buf[n_bytes++] = out_msg.peripheral;
-	buf[n_bytes++] = out_msg.n_iter;
-	buf[n_bytes++] = out_msg.p_len;
-	
-	// has payload
-	if(out_msg.p_len > 0)
-	{
-		memcpy(&buf[n_bytes], out_msg.payload, out_msg.p_len);
-		n_bytes += out_msg.p_len;
-	}
-	
-	// send
-	int sent_bytes = sendto(sock, buf, n_bytes, 0, (struct sockaddr *)&sock_addr,
-	                         sizeof(struct sockaddr));
-	if (sent_bytes < 0)
-	{
-		perror("udp_send_data: socket error");
-		exit(UDP_ERROR);
-	}
-	if ((size_t)sent_bytes != n_bytes)
-	{
-		perror("udp_send_data: incomplete transaction");
-		exit(UDP_ERROR);
-	}
+static unsigned long parse_count(const char *opt, const char *val)
+{
+    char *endptr = NULL;
+    long parsed = strtol(val, &endptr, 10);
+    if (*endptr != '\0' || parsed <= 0)
+    {
+        fprintf(stderr, "Error: '%s' requires a positive value.\n", opt);
+        exit(ARGS_ERROR);
+    }
+    return (unsigned long)parsed;
 }
 
-static void udp_receive_data(struct InMsg *in_msg)
+static void format_timestamp (struct timeval *tv, char *buffer, size_t size)
 {
-    struct sockaddr_in from_addr;
-	socklen_t from_len = sizeof(from_addr);
-	char recv_buf[sizeof(in_msg)];
-	
-	int bytes_read = recvfrom(sock, recv_buf, sizeof(in_msg), 0,
-	                          (struct sockaddr *)&from_addr, &from_len);
-	if (bytes_read < 0)
-	{
-		perror("udp_receive_data: socket error");
-		exit(UDP_ERROR);
-	}
-	if (bytes_read != IN_MSG_SIZE)
-	{
-		perror("udp_receive_data: incomplete transaction");
-        printf("Expected %d bytes, got %d\n", IN_MSG_SIZE, bytes_read);
-		exit(UDP_ERROR);
-	}
-
-	// load in_msg
-	memcpy(&in_msg->test_id, recv_buf, sizeof(in_msg->test_id));
-    in_msg->peripheral = recv_buf[sizeof(in_msg->test_id)];
-	in_msg->test_result = recv_buf[sizeof(in_msg->test_id) + sizeof(in_msg->peripheral)];
-	
-    printf("Test #%d | peripheral %d | result %d\n", in_msg->test_id, in_msg->peripheral, in_msg->test_result);
-}
\ No newline at end of file
+	struct tm tm_info;
+    localtime_r(&tv->tv_sec, &tm_info);   // Also called from the receiver thread
+    strftime(buffer, size, "%Y-%m-%d %H:%M:%S", &tm_info);
+}
@@ -0,0 +1,591 @@
+/*
+ * @file tester.c
+ *
+ * @brief Test engine: one socket, one receiver thread and a preallocated
+ * table of pending tests per Tester.
+ *
+ * Submitting threads take a free slot, serialize the OutMsg into it and
+ * send it. The receiver thread matches replies to slots by test ID, resends
+ * tests whose deadline has passed and runs completion callbacks. All slot
+ * state is guarded by Tester.mutex.
+ */
+
+#include <pthread.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tester.h"
+
+#define RECV_BATCH 64              // Replies read per wakeup before checking deadlines
+
+/*************************
+ * TYPEDEFS              *
+ *************************/
+
+/**
+ * @brief A test waiting for its replies
+ *
+ * @struct PendingTest
+ */
+typedef struct PendingTest
+{
+    int in_use;                    /** Slot holds a test */
+    uint32_t test_id;              /** Unique test ID */
+    uint8_t expected;              /** Peripherals that must reply */
+    uint8_t received;              /** Peripherals that replied so far */
+    InMsg replies[N_TESTS];        /** Replies by slot_of(peripheral) */
+    char buf[BUFSIZE];             /** Serialized OutMsg, kept for resends */
+    size_t len;                    /** Bytes used in buf */
+    struct timeval start;          /** Wall clock time of the first send */
+    double first_sent;             /** Monotonic time of the first send */
+    double sent_at;                /** Monotonic time of the latest send */
+    double deadline;               /** Resend or give up at this monotonic time */
+    int retransmits;               /** Resends so far */
+    tester_callback cb;            /** Completion callback */
+    void *user;                    /** Passed to cb */
+}PendingTest;
+
+/**
+ * @brief A finished test whose callback hasn't run yet
+ *
+ * @struct Completion
+ */
+typedef struct Completion
+{
+    TestResult result;
+    tester_callback cb;
+    void *user;
+}Completion;
+
+struct Tester
+{
+    int sock;                      /** UDP socket */
+    struct sockaddr_in addr;       /** UUT address */
+    int wake_fd;                   /** eventfd that interrupts the receiver's poll */
+    pthread_t receiver;            /** Receiver thread */
+    int stopping;                  /** Set by tester_destroy() */
+
+    pthread_mutex_t mutex;         /** Guards everything below */
+    pthread_cond_t changed;        /** Signalled whenever a test completes */
+    unsigned window;               /** Size of slots */
+    unsigned n_pending;            /** Slots in use */
+    PendingTest *slots;            /** Pending test table */
+    unsigned *free_slots;          /** Stack of unused slot indices */
+    unsigned n_free;               /** Entries on free_slots */
+    Completion *done;              /** Receiver's scratch list of completions */
+    double poll_until;             /** Earliest known deadline, 0 if none */
+
+    int have_rtt;                  /** An RTT sample has been taken */
+    double srtt;                   /** Smoothed round trip, seconds */
+    double rttvar;                 /** Round trip variation, seconds */
+    double rto;                    /** Current reply deadline, seconds */
+};
+
+/**
+ * @brief State of a tester_run() call
+ *
+ * @struct SyncRun
+ */
+typedef struct SyncRun
+{
+    Tester *t;
+    TestResult *result;
+    int finished;
+}SyncRun;
+
+/*************************
+ * FUNCTION DECLERATIONS *
+ *************************/
+
+/**
+ * @brief Receiver thread function
+ *
+ * @param arg Pointer to the Tester
+ * @return void* Always NULL
+ */
+static void *recv_thread(void *arg);
+
+/**
+ * @brief Run the callbacks of the first n_done entries of t->done
+ *
+ * @attention Called by the receiver thread without t->mutex held
+ */
+static void run_callbacks(Tester *t, unsigned n_done);
+
+/**
+ * @brief Match one reply to its pending test
+ *
+ * @attention t->mutex must be held by the caller
+ *
+ * @return int 1 if the reply completed its test (added to t->done)
+ */
+static int handle_reply(Tester *t, const char *buf, unsigned *n_done);
+
+/**
+ * @brief Resend or expire tests whose deadline has passed
+ *
+ * @attention t->mutex must be held by the caller
+ *
+ * @return int Milliseconds until the next deadline, or -1 if none
+ */
+static int check_deadlines(Tester *t, unsigned *n_done);
+
+/**
+ * @brief Free a pending test's slot and queue its result in t->done
+ *
+ * @attention t->mutex must be held by the caller
+ */
+static void complete(Tester *t, PendingTest *p, int timed_out, unsigned *n_done);
+
+/**
+ * @brief Fold an RTT sample into the smoothed estimate and recompute the RTO
+ *
+ * @attention t->mutex must be held by the caller
+ */
+static void update_rto(Tester *t, double sample_sec);
+
+/**
+ * @brief Monotonic clock in seconds
+ */
+static double now_sec(void);
+
+/**
+ * @brief Index of a peripheral code in PendingTest.replies
+ */
+static int slot_of(uint8_t peripheral);
+
+/**
+ * @brief tester_callback of tester_run()
+ */
+static void sync_run_done(const TestResult *result, void *user);
+
+/****************************
+ * FUNCTION IMPLEMENTATION  *
+ ****************************/
+
+Tester *tester_create (const char *uut_addr, unsigned window)
+{
+    if (window == 0 || window > MAX_WINDOW)
+    {
+        fprintf(stderr, "tester_create: window must be 1-%d\n", MAX_WINDOW);
+        return NULL;
+    }
+
+    struct hostent *host = gethostbyname(uut_addr);
+    if (!host)
+    {
+        fprintf(stderr, "tester_create: unknown host %s\n", uut_addr);
+        return NULL;
+    }
+
+    Tester *t = calloc(1, sizeof(Tester));
+    if (!t)
+    {
+        perror("calloc");
+        return NULL;
+    }
+    t->window = window;
+    t->rto = RTO_INITIAL_MS / 1000.0;
+    t->slots = calloc(window, sizeof(PendingTest));
+    t->free_slots = calloc(window, sizeof(unsigned));
+    t->done = calloc(window, sizeof(Completion));
+    t->sock = -1;
+    t->wake_fd = -1;
+    if (!t->slots || !t->free_slots || !t->done)
+    {
+        perror("calloc");
+        goto fail;
+    }
+    for (unsigned i = 0; i < window; ++i)
+        t->free_slots[i] = window - 1 - i;
+    t->n_free = window;
+
+    if ((t->sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    {
+        perror("socket");
+        goto fail;
+    }
+
+    // Not connected: the bridge sends replies from another port
+    t->addr.sin_family = AF_INET;
+    t->addr.sin_port = htons(PORT);
+    t->addr.sin_addr = *((struct in_addr *)host->h_addr);
+
+    if ((t->wake_fd = eventfd(0, EFD_NONBLOCK)) < 0)
+    {
+        perror("eventfd");
+        goto fail;
+    }
+
+    pthread_mutex_init(&t->mutex, NULL);
+    pthread_cond_init(&t->changed, NULL);
+    if (pthread_create(&t->receiver, NULL, recv_thread, t) != 0)
+    {
+        perror("pthread_create");
+        pthread_cond_destroy(&t->changed);
+        pthread_mutex_destroy(&t->mutex);
+        goto fail;
+    }
+    return t;
+
+fail:
+    if (t->wake_fd >= 0) close(t->wake_fd);
+    if (t->sock >= 0) close(t->sock);
+    free(t->done);
+    free(t->free_slots);
+    free(t->slots);
+    free(t);
+    return NULL;
+}
+
+void tester_destroy (Tester *t)
+{
+    if (!t) return;
+
+    tester_wait(t);
+
+    pthread_mutex_lock(&t->mutex);
+    t->stopping = 1;
+    pthread_mutex_unlock(&t->mutex);
+    uint64_t one = 1;
+    if (write(t->wake_fd, &one, sizeof(one)) < 0) perror("write");
+    pthread_join(t->receiver, NULL);
+
+    pthread_cond_destroy(&t->changed);
+    pthread_mutex_destroy(&t->mutex);
+    close(t->wake_fd);
+    close(t->sock);
+    free(t->done);
+    free(t->free_slots);
+    free(t->slots);
+    free(t);
+}
+
+int tester_submit (Tester *t, uint32_t test_id, uint8_t peripherals, uint8_t n_iter,
+                   const char *payload, uint8_t p_len, tester_callback cb, void *user)
+{
+    peripherals &= TEST_UART | TEST_SPI | TEST_I2C;
+    if (peripherals == 0)
+    {
+        fprintf(stderr, "tester_submit: no peripheral to test\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&t->mutex);
+    while (t->n_free == 0)
+        pthread_cond_wait(&t->changed, &t->mutex);
+
+    PendingTest *p = &t->slots[t->free_slots[--t->n_free]];
+    p->in_use = 1;
+    p->test_id = test_id;
+    p->expected = peripherals;
+    p->received = 0;
+    p->retransmits = 0;
+    p->cb = cb;
+    p->user = user;
+
+    // load buffer
+    p->len = wire_put_out_msg(p->buf, test_id, peripherals, n_iter, payload, p_len);
+
+    gettimeofday(&p->start, NULL);
+    p->first_sent = p->sent_at = now_sec();
+    p->deadline = p->sent_at + t->rto;
+    t->n_pending++;
+
+    int sent = sendto(t->sock, p->buf, p->len, 0, (struct sockaddr *)&t->addr, sizeof(t->addr));
+    if (sent < 0 || (size_t)sent != p->len)
+    {
+        perror(sent < 0 ? "tester_submit: socket error" : "tester_submit: incomplete transaction");
+        p->in_use = 0;
+        t->free_slots[t->n_free++] = p - t->slots;
+        t->n_pending--;
+        pthread_mutex_unlock(&t->mutex);
+        return 0;
+    }
+
+    // Wake the receiver if it is sleeping past this test's deadline
+    int wake = t->poll_until == 0 || p->deadline < t->poll_until;
+    if (wake) t->poll_until = p->deadline;
+    pthread_mutex_unlock(&t->mutex);
+
+    if (wake)
+    {
+        uint64_t one = 1;
+        if (write(t->wake_fd, &one, sizeof(one)) < 0) perror("write");
+    }
+    return 1;
+}
+
+int tester_run (Tester *t, uint32_t test_id, uint8_t peripherals, uint8_t n_iter,
+                const char *payload, uint8_t p_len, TestResult *result)
+{
+    SyncRun run = { .t = t, .result = result, .finished = 0 };
+    if (!tester_submit(t, test_id, peripherals, n_iter, payload, p_len, sync_run_done, &run))
+        return 0;
+
+    pthread_mutex_lock(&t->mutex);
+    while (!run.finished)
+        pthread_cond_wait(&t->changed, &t->mutex);
+    pthread_mutex_unlock(&t->mutex);
+    return 1;
+}
+
+void tester_wait (Tester *t)
+{
+    pthread_mutex_lock(&t->mutex);
+    while (t->n_pending > 0)
+        pthread_cond_wait(&t->changed, &t->mutex);
+    pthread_mutex_unlock(&t->mutex);
+}
+
+static void sync_run_done (const TestResult *result, void *user)
+{
+    SyncRun *run = user;
+    *run->result = *result;
+
+    pthread_mutex_lock(&run->t->mutex);
+    run->finished = 1;
+    pthread_cond_broadcast(&run->t->changed);
+    pthread_mutex_unlock(&run->t->mutex);
+}
+
+static void *recv_thread (void *arg)
+{
+    Tester *t = arg;
+    char recv_buf[RECV_BATCH][BUFSIZE];
+    int lens[RECV_BATCH];
+
+    while (1)
+    {
+        unsigned n_done = 0;
+
+        pthread_mutex_lock(&t->mutex);
+        if (t->stopping)
+        {
+            pthread_mutex_unlock(&t->mutex);
+            break;
+        }
+        int timeout_ms = check_deadlines(t, &n_done);
+        pthread_mutex_unlock(&t->mutex);
+
+        if (n_done > 0)
+        {
+            run_callbacks(t, n_done);
+            continue;
+        }
+
+        struct pollfd pfd[2] = {
+            { .fd = t->sock, .events = POLLIN },
+            { .fd = t->wake_fd, .events = POLLIN },
+        };
+        int rc = poll(pfd, 2, timeout_ms);
+        if (rc < 0 && errno != EINTR)
+        {
+            perror("recv_thread: poll error");
+            break;
+        }
+        if (rc <= 0) continue;
+
+        if (pfd[1].revents & POLLIN)
+        {
+            uint64_t count;
+            if (read(t->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read");
+        }
+        if (!(pfd[0].revents & POLLIN)) continue;
+
+        // Drain what has arrived, then match it all under one lock
+        int n_recv = 0;
+        while (n_recv < RECV_BATCH)
+        {
+            lens[n_recv] = recvfrom(t->sock, recv_buf[n_recv], BUFSIZE, MSG_DONTWAIT, NULL, NULL);
+            if (lens[n_recv] < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    perror("recv_thread: socket error");
+                break;
+            }
+            n_recv++;
+        }
+
+        pthread_mutex_lock(&t->mutex);
+        for (int i = 0; i < n_recv; ++i)
+        {
+            if (lens[i] != IN_MSG_SIZE)
+            {
+                fprintf(stderr, "recv_thread: expected %d bytes, got %d. Reply dropped\n",
+                        IN_MSG_SIZE, lens[i]);
+                continue;
+            }
+            handle_reply(t, recv_buf[i], &n_done);
+        }
+        pthread_mutex_unlock(&t->mutex);
+
+        if (n_done > 0) run_callbacks(t, n_done);
+    }
+
+    return NULL;
+}
+
+static void run_callbacks (Tester *t, unsigned n_done)
+{
+    // Callbacks run unlocked, so they may take their own locks freely
+    for (unsigned i = 0; i < n_done; ++i)
+        if (t->done[i].cb) t->done[i].cb(&t->done[i].result, t->done[i].user);
+
+    pthread_mutex_lock(&t->mutex);
+    t->n_pending -= n_done;
+    pthread_cond_broadcast(&t->changed);
+    pthread_mutex_unlock(&t->mutex);
+}
+
+static int handle_reply (Tester *t, const char *buf, unsigned *n_done)
+{
+    wire_test_t reply = wire_get_in_msg(buf);
+    InMsg msg = {reply.test_id, reply.peripheral, reply.value};
+
+    int slot = slot_of(msg.peripheral);
+    if (slot < 0) return 0;
+
+    for (unsigned i = 0; i < t->window; ++i)
+    {
+        PendingTest *p = &t->slots[i];
+        if (!p->in_use || p->test_id != msg.test_id) continue;
+
+        // Late duplicates of a resent test are ignored
+        if (!(p->expected & msg.peripheral) || (p->received & msg.peripheral)) return 0;
+
+        p->replies[slot] = msg;
+        p->received |= msg.peripheral;
+        if (p->received != p->expected) return 0;
+
+        complete(t, p, 0, n_done);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_deadlines (Tester *t, unsigned *n_done)
+{
+    double now = now_sec();
+    if (t->poll_until != 0 && now < t->poll_until)
+        return (int)((t->poll_until - now) * 1000) + 1;
+
+    double next = 0;
+    for (unsigned i = 0; i < t->window; ++i)
+    {
+        PendingTest *p = &t->slots[i];
+        if (!p->in_use) continue;
+
+        if (p->deadline <= now)
+        {
+            if (p->retransmits >= MAX_RETRANSMITS)
+            {
+                complete(t, p, 1, n_done);
+                continue;
+            }
+
+            ++p->retransmits;
+            double backoff = t->rto * (1 << p->retransmits);
+            if (backoff > RTO_MAX_MS / 1000.0) backoff = RTO_MAX_MS / 1000.0;
+            p->sent_at = now;
+            p->deadline = now + backoff;
+            if (sendto(t->sock, p->buf, p->len, 0, (struct sockaddr *)&t->addr, sizeof(t->addr)) < 0)
+                perror("check_deadlines: socket error");
+        }
+        if (next == 0 || p->deadline < next) next = p->deadline;
+    }
+
+    t->poll_until = next;
+    if (next == 0) return -1;
+    return (int)((next - now) * 1000) + 1;
+}
+
+static void complete (Tester *t, PendingTest *p, int timed_out, unsigned *n_done)
+{
+    Completion *c = &t->done[(*n_done)++];
+    TestResult *r = &c->result;
+    double now = now_sec();
+
+    r->test_id = p->test_id;
+    r->peripherals = p->expected;
+    r->n_replies = 0;
+    r->success = !timed_out;
+    r->timed_out = timed_out;
+    r->retransmits = p->retransmits;
+    r->start = p->start;
+    r->duration_sec = now - p->first_sent;
+
+    const uint8_t codes[N_TESTS] = { TEST_UART, TEST_SPI, TEST_I2C };
+    for (int i = 0; i < N_TESTS; ++i)
+    {
+        if (!(p->expected & codes[i])) continue;
+        InMsg msg = p->replies[slot_of(codes[i])];
+        if (!(p->received & codes[i]))
+        {
+            msg.test_id = p->test_id;
+            msg.peripheral = codes[i];
+            msg.test_result = TEST_FAILED;
+        }
+        r->replies[r->n_replies++] = msg;
+        if (msg.test_result != TEST_SUCCESS) r->success = 0;
+    }
+
+    // Karn's algorithm: a resent test's reply can't be matched to one send
+    if (!timed_out && p->retransmits == 0) update_rto(t, now - p->sent_at);
+
+    c->cb = p->cb;
+    c->user = p->user;
+
+    // The slot is reused at once; n_pending drops after the callback ran
+    p->in_use = 0;
+    t->free_slots[t->n_free++] = p - t->slots;
+}
+
+static void update_rto (Tester *t, double sample_sec)
+{
+    if (!t->have_rtt)
+    {
+        t->srtt = sample_sec;
+        t->rttvar = sample_sec / 2;
+        t->have_rtt = 1;
+    }
+    else
+    {
+        double err = t->srtt - sample_sec;
+        t->rttvar = 0.75 * t->rttvar + 0.25 * (err < 0 ? -err : err);
+        t->srtt = 0.875 * t->srtt + 0.125 * sample_sec;
+    }
+
+    double var = 4 * t->rttvar;
+    t->rto = t->srtt + (var > 0.001 ? var : 0.001);
+    if (t->rto < RTO_MIN_MS / 1000.0) t->rto = RTO_MIN_MS / 1000.0;
+    if (t->rto > RTO_MAX_MS / 1000.0) t->rto = RTO_MAX_MS / 1000.0;
+}
+
+static double now_sec (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int slot_of (uint8_t peripheral)
+{
+    switch (peripheral)
+    {
+        case TEST_UART: return 0;
+        case TEST_SPI: return 1;
+        case TEST_I2C: return 2;
+        default: return -1;
+    }
+}
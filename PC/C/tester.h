@@ -0,0 +1,145 @@
+/**
+ * @file tester.h
+ * @brief Reusable test engine for the STM32F756ZG hardware tester
+ *
+ * A Tester owns one UDP socket, a receiver thread and a fixed table of
+ * pending tests, all set up once by tester_create(). Tests are then
+ * submitted without further allocations or thread creation, and up to
+ * `window` of them may be in flight at a time. Each test is resent on an
+ * adaptive deadline (RFC 6298 style, as in the C++ tester) and completes
+ * as timed out after MAX_RETRANSMITS resends.
+ *
+ * The engine doesn't touch the tests database, so it can be linked into
+ * other programs on its own (libmthw_tester.a).
+ */
+#pragma once
+#include <stdint.h>
+#include <sys/time.h>
+#include "wire.h"
+
+/*************************
+ * MACROS                *
+ *************************/
+
+#define PORT 54321                 // Port for UDP communication
+#define BUFSIZE WIRE_OUT_MSG_MAX_SIZE   // Max possible size of OutMsg
+#define MAX_PAYLOAD WIRE_MAX_PAYLOAD    // Max payload length (p_len is one byte)
+#define IN_MSG_SIZE WIRE_IN_MSG_SIZE    // Incoming msg is always 6 bytes
+
+#define TEST_UART 2                // UART test code
+#define TEST_SPI 4                 // SPI test code
+#define TEST_I2C 8                 // I2C test code
+
+#define TEST_SUCCESS 0x01          // Test success code
+#define TEST_FAILED 0xff           // Test failed code
+
+#define N_TESTS 3                  // Total number of test types
+
+#define RTO_INITIAL_MS 3000        // Reply deadline before any RTT sample
+#define RTO_MIN_MS 200             // Lower bound of the adaptive deadline
+#define RTO_MAX_MS 60000           // Upper bound, also after backoff
+#define MAX_RETRANSMITS 3          // Resends of an OutMsg before giving up
+
+#define MAX_WINDOW 4096            // Most tests a Tester can keep in flight
+
+/*************************
+ * TYPEDEFS              *
+ *************************/
+
+/**
+ * @brief Holds data for incoming communication
+ *
+ * @struct InMsg
+ */
+typedef struct InMsg
+{
+    uint32_t test_id;              /** Unique test ID */
+    uint8_t peripheral;            /** Peripheral code */
+    uint8_t test_result;           /** Test result (success/fail) */
+}InMsg;
+
+/**
+ * @brief Outcome of one test
+ *
+ * @struct TestResult
+ */
+typedef struct TestResult
+{
+    uint32_t test_id;              /** Unique test ID */
+    uint8_t peripherals;           /** Peripheral code bitfield that was tested */
+    int n_replies;                 /** Number of entries in replies */
+    InMsg replies[N_TESTS];        /** One per tested peripheral, UART/SPI/I2C order */
+    int success;                   /** 1 if every peripheral replied TEST_SUCCESS */
+    int timed_out;                 /** 1 if some reply never came (marked TEST_FAILED) */
+    int retransmits;               /** Times the OutMsg was resent */
+    struct timeval start;          /** Wall clock time of the first send */
+    double duration_sec;           /** First send to last reply (or giving up) */
+}TestResult;
+
+/**
+ * @brief Called once per submitted test, from the receiver thread
+ *
+ * @attention Must not call tester_submit(), tester_run(), tester_wait()
+ * or tester_destroy() on the same Tester.
+ */
+typedef void (*tester_callback)(const TestResult *result, void *user);
+
+/**
+ * @brief Test engine context, see tester_create()
+ */
+typedef struct Tester Tester;
+
+/*************************
+ * FUNCTION DECLERATIONS *
+ *************************/
+
+/**
+ * @brief Open a socket to a UUT and start the receiver thread
+ *
+ * @param uut_addr UUT host name or IPv4 address
+ * @param window Most tests in flight at once (1 to MAX_WINDOW)
+ * @return Tester* New context, or NULL on error (reason printed to stderr)
+ */
+Tester *tester_create (const char *uut_addr, unsigned window);
+
+/**
+ * @brief Wait for all pending tests, then stop the receiver and free t
+ *
+ * @param t Context from tester_create(), may be NULL
+ */
+void tester_destroy (Tester *t);
+
+/**
+ * @brief Send a test and return without waiting for its replies
+ *
+ * Blocks while `window` tests are already in flight. cb is called when the
+ * test completes or times out.
+ *
+ * @param t Tester context
+ * @param test_id Unique test ID (use get_next_id() to get it beforehand)
+ * @param peripherals Peripherals code bitfield
+ * @param n_iter Number of test iterations
+ * @param payload Bit pattern for the test
+ * @param p_len Payload length, up to MAX_PAYLOAD
+ * @param cb Completion callback, may be NULL
+ * @param user Passed to cb
+ * @return int 1 if sent, 0 otherwise
+ */
+int tester_submit (Tester *t, uint32_t test_id, uint8_t peripherals, uint8_t n_iter,
+                   const char *payload, uint8_t p_len, tester_callback cb, void *user);
+
+/**
+ * @brief Run one test and wait for its result
+ *
+ * @param result Destination for the outcome
+ * @return int 1 if the test ran (see result->success), 0 if it couldn't be sent
+ */
+int tester_run (Tester *t, uint32_t test_id, uint8_t peripherals, uint8_t n_iter,
+                const char *payload, uint8_t p_len, TestResult *result);
+
+/**
+ * @brief Wait until every submitted test has completed
+ *
+ * @param t Tester context
+ */
+void tester_wait (Tester *t);
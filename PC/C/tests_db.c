@@ -1,4 +1,5 @@
 #include <sqlite3.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,12 +8,92 @@
 
 static char *db_path;
 
+/**
+ * Connection and cached statements, guarded by db_mutex
+ */
+static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sqlite3 *db;
+static sqlite3_stmt *insert_stmt;
+static sqlite3_stmt *select_id_stmt;
+static sqlite3_stmt *select_all_stmt;
+static sqlite3_stmt *next_id_stmt;
+static sqlite3_stmt *reserve_stmt;
+
+/*************************
+ * FUNCTION DECLERATIONS *
+ *************************/
+
+/**
+ * @brief Open the database unless it is open already
+ *
+ * @attention db_mutex must be held by the caller
+ *
+ * @return int 1 if successful, 0 otherwise
+ */
+static int ensure_open (void);
+
+/**
+ * @brief Give test_logs a primary key if it was created without one
+ *
+ * Older databases have a plain test_id column, which makes MAX(test_id)
+ * and lookups by ID full table scans. Duplicate IDs keep their first row.
+ * Same migration as the C++ tester's.
+ *
+ * @attention db_mutex must be held by the caller
+ *
+ * @return int 1 if successful, 0 otherwise
+ */
+static int migrate (void);
+
+/**
+ * @brief Prepare a statement on the open connection
+ *
+ * @param sql SQL text
+ * @param dest Destination for the statement
+ * @return int 1 if successful, 0 otherwise
+ */
+static int prepare (const char *sql, sqlite3_stmt **dest);
+
+/**
+ * @brief Bind and step insert_stmt for one record
+ *
+ * @attention db_mutex must be held by the caller
+ *
+ * @return int 1 if successful, 0 otherwise
+ */
+static int insert_record (uint32_t test_id, const char *timestamp,
+                          double duration_sec, int result);
+
+/**
+ * @brief Finalize cached statements and close the connection
+ *
+ * @attention db_mutex must be held by the caller
+ */
+static void close_locked (void);
+
 /****************************
  * FUNCTION IMPLEMENTATION  *
  ****************************/
 
-int init_db (void)
+int db_open (void)
+{
+    pthread_mutex_lock(&db_mutex);
+    int ok = ensure_open();
+    pthread_mutex_unlock(&db_mutex);
+    return ok;
+}
+
+void db_close (void)
+{
+    pthread_mutex_lock(&db_mutex);
+    close_locked();
+    pthread_mutex_unlock(&db_mutex);
+}
+
+static int ensure_open (void)
 {
+    if (db) return 1;
+
 #ifdef LOCAL_DB_PATH
     db_path = "test_records.db";
 #else
@@ -29,108 +110,207 @@ int init_db (void)
     // ensure existance of directory
     char dir_path[512];
     snprintf(dir_path, sizeof(dir_path), "%s/HW_tester", home);
-    mkdir(dir_path, 0755); 
-    
+    mkdir(dir_path, 0755);
+
     // init path pointer
     db_path = buf;
 #endif
 
     // create the database
-    sqlite3 *db;
     char *err_msg = NULL;
 
     if (sqlite3_open(db_path, &db) != SQLITE_OK)
     {
         fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
-        exit(EXIT_FAILURE);
+        close_locked();
+        return 0;
     }
 
     const char *sql =
         "CREATE TABLE IF NOT EXISTS test_logs ("
-        "test_id INTEGER, "
+        "test_id INTEGER PRIMARY KEY, "
         "timestamp TEXT, "
         "duration REAL, "
-        "result INTEGER);";
+        "result INTEGER);"
+        "CREATE TABLE IF NOT EXISTS id_alloc ("
+        "id INTEGER PRIMARY KEY CHECK (id = 0), "
+        "next_id INTEGER NOT NULL);";
 
     if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
     {
         fprintf(stderr, "SQL error: %s\n", err_msg);
         sqlite3_free(err_msg);
-        sqlite3_close(db);
+        close_locked();
         return 0;
     }
 
-    sqlite3_close(db);
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+    if (!migrate())
+    {
+        close_locked();
+        return 0;
+    }
+
+    // WAL lets readers run while a batch is committed, and with
+    // synchronous=NORMAL a commit no longer waits for an fsync.
+    if (sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", 0, 0, &err_msg) != SQLITE_OK)
+    {
+        fprintf(stderr, "Journal mode error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        close_locked();
+        return 0;
+    }
+
+    if (!prepare("INSERT INTO test_logs (test_id, timestamp, duration, result) "
+                 "VALUES (?, ?, ?, ?);", &insert_stmt) ||
+        !prepare("SELECT test_id, timestamp, duration, result "
+                 "FROM test_logs WHERE test_id = ?;", &select_id_stmt) ||
+        !prepare("SELECT test_id, timestamp, duration, result "
+                 "FROM test_logs ORDER BY test_id ASC;", &select_all_stmt) ||
+        !prepare("SELECT MAX(IFNULL((SELECT next_id FROM id_alloc), 1), "
+                 "IFNULL((SELECT MAX(test_id) FROM test_logs), 0) + 1);", &next_id_stmt) ||
+        !prepare("INSERT OR REPLACE INTO id_alloc (id, next_id) VALUES (0, ?);", &reserve_stmt))
+    {
+        close_locked();
+        return 0;
+    }
 
 	return 1;
 }
 
-int log_test (uint32_t test_id, const char *timestamp,
-             double duration_sec, int result)
+static int migrate (void)
 {
-	sqlite3 *db;
-
-    // open db
-    int rc = sqlite3_open(db_path, &db);
-    if (rc != SQLITE_OK)
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, "SELECT pk FROM pragma_table_info('test_logs') WHERE name = 'test_id';",
+                           -1, &stmt, 0) != SQLITE_OK)
     {
-        fprintf(stderr, "Cannot open DB: %s\n", sqlite3_errmsg(db));
+        fprintf(stderr, "Failed to read schema: %s\n", sqlite3_errmsg(db));
         return 0;
     }
+    int has_pk = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 1;
+    sqlite3_finalize(stmt);
 
-    // prepare statement
-    sqlite3_stmt *stmt;
-    const char *sql_insert = "INSERT INTO test_logs (test_id, timestamp, duration, result) "
-                             "VALUES (?, ?, ?, ?);";
+    if (has_pk) return 1;
 
-    rc = sqlite3_prepare_v2(db, sql_insert, -1, &stmt, 0);
-    if (rc != SQLITE_OK)
+    const char *sql =
+        "BEGIN IMMEDIATE;"
+        "CREATE TABLE test_logs_new ("
+        "test_id INTEGER PRIMARY KEY, "
+        "timestamp TEXT, "
+        "duration REAL, "
+        "result INTEGER);"
+        "INSERT OR IGNORE INTO test_logs_new "
+        "SELECT test_id, timestamp, duration, result FROM test_logs "
+        "WHERE test_id IS NOT NULL ORDER BY rowid;"
+        "DROP TABLE test_logs;"
+        "ALTER TABLE test_logs_new RENAME TO test_logs;"
+        "COMMIT;";
+
+    char *err_msg = NULL;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
     {
-        fprintf(stderr, "Insert prepare error: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+        fprintf(stderr, "Migration error: %s\n", err_msg);
+        sqlite3_free(err_msg);
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, NULL);
         return 0;
     }
+    return 1;
+}
+
+static int prepare (const char *sql, sqlite3_stmt **dest)
+{
+    if (sqlite3_prepare_v2(db, sql, -1, dest, 0) != SQLITE_OK)
+    {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+    return 1;
+}
 
+static void close_locked (void)
+{
+    sqlite3_stmt **stmts[] = { &insert_stmt, &select_id_stmt, &select_all_stmt,
+                               &next_id_stmt, &reserve_stmt };
+    for (size_t i = 0; i < sizeof(stmts) / sizeof(stmts[0]); ++i)
+    {
+        sqlite3_finalize(*stmts[i]);
+        *stmts[i] = NULL;
+    }
+
+    sqlite3_close(db);
+    db = NULL;
+}
+
+static int insert_record (uint32_t test_id, const char *timestamp,
+                          double duration_sec, int result)
+{
     // bind variables
-    sqlite3_bind_int(stmt, 1, test_id);
-    sqlite3_bind_text(stmt, 2, timestamp, -1, SQLITE_STATIC);
-    sqlite3_bind_double(stmt, 3, duration_sec);
-    sqlite3_bind_int(stmt, 4, result); 
+    sqlite3_bind_int64(insert_stmt, 1, test_id);
+    sqlite3_bind_text(insert_stmt, 2, timestamp, -1, SQLITE_STATIC);
+    sqlite3_bind_double(insert_stmt, 3, duration_sec);
+    sqlite3_bind_int(insert_stmt, 4, result);
 
     // insert log
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(insert_stmt);
     if (rc != SQLITE_DONE)
     {
         fprintf(stderr, "Insert step error: %s\n", sqlite3_errmsg(db));
     }
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return 1;
+    sqlite3_reset(insert_stmt);
+    sqlite3_clear_bindings(insert_stmt);
+    return rc == SQLITE_DONE;
 }
 
-int print_all_logs (void)
+int log_test (uint32_t test_id, const char *timestamp,
+             double duration_sec, int result)
 {
-	sqlite3 *db;
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT test_id, timestamp, duration, result "
-                      "FROM test_logs ORDER BY test_id ASC;";
+    pthread_mutex_lock(&db_mutex);
+    int ok = ensure_open() && insert_record(test_id, timestamp, duration_sec, result);
+    pthread_mutex_unlock(&db_mutex);
+    return ok;
+}
 
-    // open db
-    int rc = sqlite3_open(db_path, &db);
-    if (rc != SQLITE_OK)
+int log_tests (const TestRecord *records, size_t n)
+{
+    pthread_mutex_lock(&db_mutex);
+    if (!ensure_open())
     {
-        fprintf(stderr, "Cannot open DB: %s\n", sqlite3_errmsg(db));
+        pthread_mutex_unlock(&db_mutex);
         return 0;
     }
 
-    // prepare statement
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK)
+    if (sqlite3_exec(db, "BEGIN;", 0, 0, NULL) != SQLITE_OK)
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+        fprintf(stderr, "Cannot begin transaction: %s\n", sqlite3_errmsg(db));
+        pthread_mutex_unlock(&db_mutex);
+        return 0;
+    }
+
+    int ok = 1;
+    for (size_t i = 0; i < n && ok; ++i)
+    {
+        ok = insert_record(records[i].test_id, records[i].timestamp,
+                           records[i].duration_sec, records[i].result);
+    }
+
+    if (!ok || sqlite3_exec(db, "COMMIT;", 0, 0, NULL) != SQLITE_OK)
+    {
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, NULL);
+        ok = 0;
+    }
+
+    pthread_mutex_unlock(&db_mutex);
+    return ok;
+}
+
+int print_all_logs (void)
+{
+    pthread_mutex_lock(&db_mutex);
+    if (!ensure_open())
+    {
+        pthread_mutex_unlock(&db_mutex);
         return 0;
     }
 
@@ -138,14 +318,15 @@ int print_all_logs (void)
     printf("test_id, timestamp, duration, result\n");
 
     // csv data
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    int rc;
+    while ((rc = sqlite3_step(select_all_stmt)) == SQLITE_ROW)
     {
-        int id = sqlite3_column_int(stmt, 0);
-        const unsigned char *timestamp = sqlite3_column_text(stmt, 1);
-        double duration = sqlite3_column_double(stmt, 2);
-        int result = sqlite3_column_int(stmt, 3);
+        uint32_t id = sqlite3_column_int64(select_all_stmt, 0);
+        const unsigned char *timestamp = sqlite3_column_text(select_all_stmt, 1);
+        double duration = sqlite3_column_double(select_all_stmt, 2);
+        int result = sqlite3_column_int(select_all_stmt, 3);
 
-        printf("%d,%s,%f,%d\n", id, timestamp, duration, result);
+        printf("%u,%s,%f,%d\n", id, timestamp, duration, result);
     }
 
     if (rc != SQLITE_DONE)
@@ -153,48 +334,33 @@ int print_all_logs (void)
         fprintf(stderr, "Error while reading rows: %s\n", sqlite3_errmsg(db));
     }
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    sqlite3_reset(select_all_stmt);
+    pthread_mutex_unlock(&db_mutex);
     return 1;
 }
 
 int print_log_by_id (uint32_t test_id)
 {
-	sqlite3 *db;
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT test_id, timestamp, duration, result "
-                      "FROM test_logs WHERE test_id = ?;";
-
-    // open db
-    int rc = sqlite3_open(db_path, &db);
-    if (rc != SQLITE_OK)
-    {
-        fprintf(stderr, "Cannot open DB: %s\n", sqlite3_errmsg(db));
-        return 0;
-    }
-
-    // prepare statement
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK)
+    pthread_mutex_lock(&db_mutex);
+    if (!ensure_open())
     {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+        pthread_mutex_unlock(&db_mutex);
         return 0;
     }
 
     // bind variable
-    sqlite3_bind_int(stmt, 1, test_id);
+    sqlite3_bind_int64(select_id_stmt, 1, test_id);
 
     // print record
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(select_id_stmt);
     if (rc == SQLITE_ROW)
     {
-        int id = sqlite3_column_int(stmt, 0);
-        const unsigned char *timestamp = sqlite3_column_text(stmt, 1);
-        double duration = sqlite3_column_double(stmt, 2);
-        int result = sqlite3_column_int(stmt, 3);
+        uint32_t id = sqlite3_column_int64(select_id_stmt, 0);
+        const unsigned char *timestamp = sqlite3_column_text(select_id_stmt, 1);
+        double duration = sqlite3_column_double(select_id_stmt, 2);
+        int result = sqlite3_column_int(select_id_stmt, 3);
 
-        printf("Test ID: %d\n", id);
+        printf("Test ID: %u\n", id);
         printf("Start Time: %s\n", timestamp);
         printf("Duration: %.6f seconds\n", duration);
         printf("Result: %s\n", result? "Success" : "Failure");
@@ -204,46 +370,59 @@ int print_log_by_id (uint32_t test_id)
         printf("No record found for test ID %u.\n", test_id);
     }
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+    sqlite3_reset(select_id_stmt);
+    pthread_mutex_unlock(&db_mutex);
     return 1;
 }
 
 int get_next_id (uint32_t *dest)
 {
-	sqlite3 *db;
-    sqlite3_stmt *res;
+    return reserve_ids(dest, 1);
+}
 
-    // open db
-    int rc = sqlite3_open(db_path, &db);
-    if (rc != SQLITE_OK)
+int reserve_ids (uint32_t *first, uint32_t count)
+{
+    pthread_mutex_lock(&db_mutex);
+    if (!ensure_open())
     {
-		fprintf(stderr, "Cannot open DB: %s\n", sqlite3_errmsg(db));
+        pthread_mutex_unlock(&db_mutex);
         return 0;
     }
 
-    // prepare statement
-    const char *sql = "SELECT MAX(test_id) FROM test_logs;";
-    rc = sqlite3_prepare_v2(db, sql, -1, &res, 0);
-    if (rc != SQLITE_OK)
+    // IMMEDIATE takes the write lock up front, so two testers can't both
+    // read the same next_id
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", 0, 0, NULL) != SQLITE_OK)
     {
-		fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
-        sqlite3_close(db);
+        fprintf(stderr, "Cannot begin transaction: %s\n", sqlite3_errmsg(db));
+        pthread_mutex_unlock(&db_mutex);
         return 0;
     }
 
     // find next ID
-    rc = sqlite3_step(res);
-    if (rc == SQLITE_ROW && sqlite3_column_type(res, 0) != SQLITE_NULL)
+    sqlite3_int64 next = 0;
+    if (sqlite3_step(next_id_stmt) == SQLITE_ROW)
     {
-        *dest = sqlite3_column_int(res, 0) + 1;
+        next = sqlite3_column_int64(next_id_stmt, 0);
     }
-    else
+    sqlite3_reset(next_id_stmt);
+
+    int ok = next > 0;
+    if (ok)
     {
-        *dest = 0; // no records yet
+        sqlite3_bind_int64(reserve_stmt, 1, next + count);
+        ok = sqlite3_step(reserve_stmt) == SQLITE_DONE;
+        sqlite3_reset(reserve_stmt);
     }
 
-    sqlite3_finalize(res);
-    sqlite3_close(db);
+    if (!ok || sqlite3_exec(db, "COMMIT;", 0, 0, NULL) != SQLITE_OK)
+    {
+        fprintf(stderr, "Failed to reserve test IDs: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, NULL);
+        pthread_mutex_unlock(&db_mutex);
+        return 0;
+    }
+
+    *first = (uint32_t)next;
+    pthread_mutex_unlock(&db_mutex);
     return 1;
 }
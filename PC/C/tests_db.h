@@ -3,6 +3,7 @@
  * @brief Database interface for hardware testing program
  */
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 /* 
@@ -12,16 +13,47 @@
  */
 // #define LOCAL_DB_PATH 1
 
+#define DB_BUSY_TIMEOUT_MS 5000    // Wait for other processes holding the DB lock
+#define TIMESTAMP_BUFSIZE 32       // Room for "YYYY-MM-DD HH:MM:SS" and then some
+
+/*************************
+ * TYPEDEFS              *
+ *************************/
+
+/**
+ * @brief One row of test_logs, for log_tests()
+ * 
+ * @struct TestRecord
+ */
+typedef struct TestRecord
+{
+    uint32_t test_id;                    /** Unique test ID */
+    char timestamp[TIMESTAMP_BUFSIZE];   /** Start time string */
+    double duration_sec;                 /** Test duration in seconds */
+    int result;                          /** Test result */
+}TestRecord;
+
 /*************************
  * FUNCTION DECLERATIONS *
  *************************/
 
 /**
- * @brief Init tests database
+ * @brief Open the tests database and keep it open until db_close()
+ * 
+ * Creates the schema if needed, switches the database to WAL mode and
+ * prepares the statements used by the functions below. Those functions
+ * open the database themselves if it isn't open yet. All of them may be
+ * called from any thread.
  * 
  * @return int 1 if successful, 0 otherwise
  */
-int init_db (void);
+int db_open (void);
+
+/**
+ * @brief Finalize cached statements and close the database
+ * 
+ */
+void db_close (void);
 
 /**
  * @brief Log a test to database
@@ -35,6 +67,15 @@ int init_db (void);
 int log_test (uint32_t test_id, const char *timestamp,
              double duration_sec, int result);
 
+/**
+ * @brief Log many tests in a single transaction
+ * 
+ * @param records Tests to log
+ * @param n Number of records
+ * @return int 1 if all were logged, 0 otherwise (none are)
+ */
+int log_tests (const TestRecord *records, size_t n);
+
 /**
  * @brief Print all logs to stdout in a csv format
  * 
@@ -60,3 +101,16 @@ int print_log_by_id (uint32_t test_id);
  * @return int 1 if successful, 0 otherwise
  */
 int get_next_id (uint32_t *dest);
+
+/**
+ * @brief Reserve a block of consecutive test IDs
+ * 
+ * The block starts after both the last reserved ID and the highest logged
+ * ID, and is recorded in the database, so other testers sharing it (C or
+ * C++) never hand out the same IDs.
+ * 
+ * @param first Destination for the first ID of the block
+ * @param count Number of IDs to reserve
+ * @return int 1 if successful, 0 otherwise
+ */
+int reserve_ids (uint32_t *first, uint32_t count);
@@ -0,0 +1,168 @@
+// FakeUut.cpp
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "FakeUut.hpp"
+
+/**
+ * @brief Binds the fake UUT's request socket and starts answering requests.
+ *
+ * @return true if the sockets could be set up.
+ * @return false otherwise (e.g. another UUT emulator holds the port).
+ */
+bool FakeUut::start()
+{
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    reply_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0 || reply_sock < 0)
+    {
+        perror("socket");
+        stop();
+        return false;
+    }
+
+    struct timeval tv = {0, 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(LOOPBACK_PORT);
+    inet_pton(AF_INET, LOOPBACK_ADDR, &addr.sin_addr);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind " LOOPBACK_ADDR);
+        stop();
+        return false;
+    }
+
+    server = std::thread(&FakeUut::serve, this);
+    return true;
+}
+
+/**
+ * @brief Stops the server thread and closes the sockets.
+ *
+ */
+void FakeUut::stop()
+{
+    if (server.joinable())
+    {
+        stopping = true;
+        server.join();
+    }
+    for (int *fd : {&sock, &reply_sock})
+    {
+        if (*fd != -1)
+        {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+/**
+ * @brief Server thread body: replies to each request with one InMsg per flag.
+ *
+ * Requests are read LOOPBACK_BATCH at a time with recvmmsg and the replies
+ * of a batch go out in one sendmmsg, so the fake UUT keeps up with the
+ * tester on the same machine.
+ */
+void FakeUut::serve()
+{
+    static_assert(OUT_MSG_BUFSIZE <= WIRE_MAX_REQ_SIZE);
+    char in[LOOPBACK_BATCH][WIRE_MAX_REQ_SIZE];
+    std::vector<char> out_buf(LOOPBACK_REPLIES * LOOPBACK_REPLY_SIZE);
+    std::vector<struct iovec> out_iov(LOOPBACK_REPLIES);
+    std::vector<struct mmsghdr> out_msgs(LOOPBACK_REPLIES);
+    struct iovec in_iov[LOOPBACK_BATCH];
+    struct mmsghdr in_msgs[LOOPBACK_BATCH];
+    sockaddr_in from[LOOPBACK_BATCH];
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> coin(0, 1);
+
+    while (!stopping)
+    {
+        for (int i = 0; i < LOOPBACK_BATCH; ++i)
+        {
+            in_iov[i] = {in[i], sizeof(in[i])};
+            std::memset(&in_msgs[i].msg_hdr, 0, sizeof(in_msgs[i].msg_hdr));
+            in_msgs[i].msg_hdr.msg_name = &from[i];
+            in_msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+            in_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Block for the first request, then take whatever else is queued
+        int n = recvmmsg(sock, in_msgs, LOOPBACK_BATCH, MSG_WAITFORONE, nullptr);
+        if (n <= 0) continue;
+
+        int n_out = 0;
+        auto queue_reply = [&](size_t len, sockaddr_in *to) {
+            out_iov[n_out] = {&out_buf[n_out * LOOPBACK_REPLY_SIZE], len};
+            std::memset(&out_msgs[n_out].msg_hdr, 0, sizeof(out_msgs[n_out].msg_hdr));
+            out_msgs[n_out].msg_hdr.msg_name = to;
+            out_msgs[n_out].msg_hdr.msg_namelen = sizeof(*to);
+            out_msgs[n_out].msg_hdr.msg_iov = &out_iov[n_out];
+            out_msgs[n_out].msg_hdr.msg_iovlen = 1;
+            ++n_out;
+        };
+
+        for (int i = 0; i < n; ++i)
+        {
+            int n_tests = wire_check_req(in[i], in_msgs[i].msg_len);
+            bool v2 = n_tests >= 0;
+            if (!v2)
+            {
+                if (in_msgs[i].msg_len < OUT_MSG_HDR_SIZE) continue;
+                n_tests = 1;
+            }
+
+            for (int t = 0; t < n_tests; ++t)
+            {
+                // The first six bytes of an OutMsg read like a test entry
+                wire_test_t test = v2 ? wire_get_req_test(in[i], t) : wire_get_in_msg(in[i]);
+                int n_results = 0;
+
+                for (uint8_t code : {TEST_UART, TEST_SPI, TEST_I2C})
+                {
+                    if (!(test.peripheral & code) || (drop > 0 && coin(rng) < drop)) continue;
+
+                    char *reply = &out_buf[n_out * LOOPBACK_REPLY_SIZE];
+                    wire_test_t result = {test.test_id, code, 0x01, 0};
+                    if (v2)
+                    {
+                        wire_put_result(reply, n_results++, &result);
+                        continue;
+                    }
+                    wire_put_u32(reply, result.test_id);
+                    reply[4] = result.peripheral;
+                    reply[5] = result.value;
+                    queue_reply(WIRE_IN_MSG_SIZE, &from[i]);
+                }
+
+                if (n_results > 0)
+                {
+                    wire_put_reply_hdr(&out_buf[n_out * LOOPBACK_REPLY_SIZE], n_results);
+                    queue_reply(WIRE_REPLY_HDR_SIZE + n_results * WIRE_RESULT_SIZE, &from[i]);
+                }
+            }
+        }
+
+        int done = 0;
+        while (done < n_out)
+        {
+            int rc = sendmmsg(reply_sock, &out_msgs[done], n_out - done, 0);
+            if (rc < 0)
+            {
+                perror("sendmmsg");
+                break;
+            }
+            done += rc;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include "HardwareTester.hpp"
+
+#define LOOPBACK_ADDR "127.0.0.1"      // Address of the built-in fake UUT
+#define LOOPBACK_PORT 54321            // Must match PORT in HardwareTester.cpp
+#define LOOPBACK_BATCH 64              // Datagrams per recvmmsg/sendmmsg in the fake UUT
+#define LOOPBACK_REPLIES (LOOPBACK_BATCH * WIRE_MAX_TESTS * N_TESTS)  // Most replies to one batch
+#define LOOPBACK_REPLY_SIZE (WIRE_REPLY_HDR_SIZE + N_TESTS * WIRE_RESULT_SIZE)
+
+/**
+ * @brief Stand-in for bridge and STM32 that answers every OutMsg at once
+ *
+ * For each peripheral flag in a request it replies with a successful InMsg,
+ * like the real UUT. Version 2 requests get one version 2 reply per test,
+ * like from a bridge that sees each test's replies in a separate UART read.
+ * A fraction of replies can be dropped to exercise the tester's
+ * retransmission. As from the firmware's uartton_task, replies leave from a
+ * second, unbound socket, so from an ephemeral port rather than PORT.
+ */
+class FakeUut
+{
+public:
+    explicit FakeUut(double drop_rate) : drop(drop_rate) {}
+    ~FakeUut() { stop(); }
+
+    bool start();
+    void stop();
+
+private:
+    void serve();
+
+    double drop;
+    int sock = -1;                     /** Bound to LOOPBACK_PORT, receives requests */
+    int reply_sock = -1;               /** Unbound, sends replies */
+    std::thread server;
+    std::atomic<bool> stopping{false};
+};
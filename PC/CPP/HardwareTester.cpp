@@ -1,10 +1,15 @@
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 #include <netdb.h>
-#include <semaphore>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <thread>
 #include <unistd.h>
 
@@ -13,19 +18,44 @@
 
 #define UUT_ADDR "192.168.1.45"    // IP address of Unit Under Test (UUT)
 #define PORT 54321                 // Port for UDP communication
-#define BUFSIZE 263                // Max possible size of OutMsg
-#define IN_MSG_SIZE 6              // Incoming msg is always 6 bytes
-#define N_TESTS 3                  // Total number of test types
+#define BATCH_BUFSIZE 1472         // Max UDP payload of a batched reply
 
 #define TEST_SUCCESS 0x01          // Test success code
 #define TEST_FAILED 0xff           // Test failed code
 
+/*
+ * Set to 1 when the bridge is built with UDP_BATCHING. Replies then arrive
+ * as datagrams of length-prefixed (16-bit little-endian) frames.
+ */
+#define BRIDGE_BATCHING 0
+
+/*
+ * Set to 1 to send requests in the version 2 wire format (see
+ * include/wire.h), which needs a bridge that knows it. Tests queued
+ * together for the same UUT then share datagrams, and the bridge reports
+ * how long the STM32 took with each reply. Replies in either format are
+ * always accepted.
+ */
+#define BRIDGE_WIRE_V2 0
+
+#if BRIDGE_BATCHING
+#define RECV_SLOT_SIZE BATCH_BUFSIZE
+#else
+#define RECV_SLOT_SIZE WIRE_MAX_REPLY_SIZE   // Largest unbatched datagram
+#endif
+
+static_assert(TIMING_REPLY_SIZE <= RECV_SLOT_SIZE && STATS_REPLY_SIZE <= RECV_SLOT_SIZE &&
+              WIRE_MAX_REPLY_SIZE <= RECV_SLOT_SIZE);
+static_assert(WIRE_REQ_HDR_SIZE == OUT_MSG_HDR_SIZE, "SendBatch keeps either header in the same place");
+
 /**
  * @brief Construct a new Hardware Tester:: Hardware Tester object
  * 
  */
-HardwareTester::HardwareTester() : sock(-1), logger(new TestLogger())
-{}
+HardwareTester::HardwareTester() : sock(-1), logger(new TestLogger()), wakeFd(-1), readyFd(-1)
+{
+    logger->enableResultCache();
+}
 
 /**
  * @brief Destroy the Hardware Tester:: Hardware Tester object
@@ -33,21 +63,43 @@ HardwareTester::HardwareTester() : sock(-1), logger(new TestLogger())
  */
 HardwareTester::~HardwareTester()
 {
+    stopReceiver();
+    if (readyFd != -1) close(readyFd);
     if (sock != -1) close(sock);
     delete logger;
 }
 
 
 /**
- * @brief Initializes and connects the UDP socket to the UUT (Unit Under Test).
- *
- * Resolves the UUT address and sets up the sockaddr_in structure.
+ * @brief Initializes and connects the UDP socket to the default UUT (Unit Under Test).
  *
  * @return true if the connection setup succeeds.
  * @return false if socket creation or host resolution fails.
  */
 bool HardwareTester::connect()
 {
+    return connect({UUT_ADDR});
+}
+
+/**
+ * @brief Initializes the UDP socket shared by a fleet of UUTs.
+ *
+ * Resolves every UUT address and starts the receiver thread that collects
+ * replies for all tests. Replies are matched to their UUT by source
+ * address, so one socket and one thread serve the whole fleet.
+ *
+ * @param uut_addrs Host names or addresses of the bridges, at least one.
+ * @return true if the connection setup succeeds.
+ * @return false if socket creation or host resolution fails.
+ */
+bool HardwareTester::connect(const std::vector<std::string>& uut_addrs)
+{
+    if (uut_addrs.empty())
+    {
+        std::cerr << "connect: no UUT address given\n";
+        return false;
+    }
+
     sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0)
     {
@@ -55,87 +107,516 @@ bool HardwareTester::connect()
         return false;
     }
 
-    struct hostent *host = gethostbyname(UUT_ADDR);
-    if (!host)
+    int rcvbuf = SOCK_RCVBUF_BYTES;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) perror("setsockopt");
+
+    for (const std::string& name : uut_addrs)
+    {
+        struct hostent *host = gethostbyname(name.c_str());
+        if (!host)
+        {
+            std::cerr << "gethostbyname: cannot resolve " << name << "\n";
+            return false;
+        }
+
+        Uut uut;
+        uut.name = name;
+        std::memset(&uut.addr, 0, sizeof(uut.addr));
+        uut.addr.sin_family = AF_INET;
+        uut.addr.sin_port = htons(PORT);
+        uut.addr.sin_addr = *((struct in_addr *)host->h_addr);
+        uuts.push_back(uut);
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK);
+    readyFd = eventfd(0, EFD_NONBLOCK);
+    if (wakeFd < 0 || readyFd < 0)
     {
-        perror("gethostbyname");
+        perror("eventfd");
         return false;
     }
-
-    struct sockaddr_in *addr_in = (struct sockaddr_in *)&sockAddr;
-    addr_in->sin_family = AF_INET;
-    addr_in->sin_port = htons(PORT);
-    addr_in->sin_addr = *((struct in_addr *)host->h_addr);
-    memset(&(addr_in->sin_zero), 0, 8);
+    receiver = std::thread(&HardwareTester::recvLoop, this);
 
     return true;
 }
 
+/**
+ * @brief Returns the number of UUTs given to connect().
+ *
+ */
+size_t HardwareTester::uutCount() const
+{
+    return uuts.size();
+}
+
+/**
+ * @brief Returns the address of a UUT as it was given to connect().
+ *
+ * @param uut Index of the UUT, as in TestResult::uut.
+ */
+const std::string& HardwareTester::uutAddr(int uut) const
+{
+    return uuts.at(uut).name;
+}
+
 /**
  * @brief Runs a group of hardware tests based on the selected flags.
  *
- * Prepares and sends an OutMsg to the UUT and waits for corresponding responses.
- * Each peripheral test runs in a separate thread.
+ * Builds the request and runs it with runTests(const Request&).
  *
  * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
  * @param n_iter Number of iterations each test should run.
  * @param shared Optional shared payload to send with the test request.
  */
-void HardwareTester::runTests(uint8_t flags, uint8_t n_iter, std::string shared)
+void HardwareTester::runTests(uint8_t flags, uint8_t n_iter, std::string_view shared)
 {
-    inMsgs.clear();
-    results.clear();
-    threads.clear();
-
-    outMsg.p_len = shared.length();
-    outMsg.n_iter = n_iter;
-    outMsg.peripheral = flags;
-    std::strncpy(outMsg.payload, shared.c_str(), sizeof(outMsg.payload));
+    Request request(flags, n_iter, shared);
+    runTests(request);
+}
 
+/**
+ * @brief Runs one test of a prepared request.
+ *
+ * Sends the request to the first UUT, waits until the receiver thread has
+ * collected a reply for every selected peripheral and logs the result.
+ * The request is owned by the caller, so a test repeated many times can
+ * reuse the same one.
+ *
+ * @param request Peripherals, iterations and payload of the test.
+ */
+void HardwareTester::runTests(const Request& request)
+{
     uint32_t test_id;
-    if (!getNextTestId(test_id))
+    if (!submitTest(0, request, test_id)) return;
+
+    logResult(waitCompleted(test_id));
+}
+
+/**
+ * @brief Runs `count` identical tests with up to `window` of them in flight.
+ *
+ * New requests are sent as soon as earlier ones complete, so the round trip
+ * to the UUT is overlapped instead of paid once per test. Results complete
+ * in any order; each one is logged and passed to `on_complete`. Only the
+ * first UUT is tested.
+ *
+ * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
+ * @param n_iter Number of iterations each test should run.
+ * @param shared Shared payload to send with every test request.
+ * @param count Number of tests to run.
+ * @param window Maximum number of outstanding tests (at least 1).
+ * @param on_complete Optional callback, run on the calling thread.
+ */
+void HardwareTester::runPipelined(uint8_t flags, uint8_t n_iter, std::string_view shared,
+                                  unsigned count, unsigned window, const CompletionHandler& on_complete)
+{
+    runWindowed(1, Request(flags, n_iter, shared), count, window, on_complete);
+}
+
+/**
+ * @brief Runs `count` identical tests on every UUT, all boards at once.
+ *
+ * Each UUT has its own window of outstanding tests, so a slow or dead board
+ * only holds back its own tests. All results go through the same logger.
+ *
+ * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
+ * @param n_iter Number of iterations each test should run.
+ * @param shared Shared payload to send with every test request.
+ * @param count Number of tests to run per UUT.
+ * @param window Maximum number of outstanding tests per UUT (at least 1).
+ * @param on_complete Optional callback, run on the calling thread.
+ */
+void HardwareTester::runFleet(uint8_t flags, uint8_t n_iter, std::string_view shared,
+                              unsigned count, unsigned window, const CompletionHandler& on_complete)
+{
+    runWindowed(uuts.size(), Request(flags, n_iter, shared), count, window, on_complete);
+}
+
+/**
+ * @brief Sends `count` tests at a fixed `rate`, whether or not replies keep up.
+ *
+ * A dedicated sender thread works through a timetable of one test every
+ * 1/rate seconds, spread round-robin over all UUTs. A slow reply never
+ * delays later sends; if the sender itself falls behind, it sends all
+ * overdue tests at once in one sendmmsg call without moving the schedule.
+ * Each result's latency_sec is measured from the test's scheduled send
+ * time, so queueing delay under overload shows up in the tail instead of
+ * being hidden (coordinated omission). Results are logged and passed to
+ * `on_complete` on the calling thread.
+ *
+ * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
+ * @param n_iter Number of iterations each test should run.
+ * @param shared Shared payload to send with every test request.
+ * @param rate Tests per second over all UUTs (must be positive).
+ * @param count Number of tests to run.
+ * @param on_complete Optional callback, run on the calling thread.
+ */
+void HardwareTester::runOpenLoop(uint8_t flags, uint8_t n_iter, std::string_view shared,
+                                 double rate, unsigned count, const CompletionHandler& on_complete)
+{
+    using clock = std::chrono::steady_clock;
+    if (rate <= 0 || uuts.empty()) return;
+
+    const Request request(flags, n_iter, shared);
+    const auto interval = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1 / rate));
+    unsigned sent = 0;           // Guarded by pendingMutex once the sender runs
+    bool sender_done = false;    // Likewise
+
+    std::thread sender([&] {
+        SendBatch out;
+        const auto start = clock::now();
+        unsigned i = 0;
+
+        while (i < count)
+        {
+            auto due = start + interval * i;
+            std::this_thread::sleep_until(due);
+
+            // Everything scheduled up to now goes out together
+            auto now = clock::now();
+            unsigned n = 0;
+            for (; i < count && start + interval * i <= now; ++i)
+            {
+                uint32_t test_id;
+                if (!submitTest(i % uuts.size(), request, test_id, &out, nullptr, start + interval * i)) break;
+                ++n;
+            }
+            flushOutMsgs(out);
+
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            sent += n;
+            if (n == 0) break;
+        }
+
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        sender_done = true;
+        pendingCv.notify_all();
+    });
+
+    unsigned done = 0;
+    std::vector<TestResult> batch;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingCv.wait(lock, [&] { return !completed.empty() || (sender_done && done == sent); });
+            if (completed.empty()) break;
+            batch.swap(completed);
+        }
+
+        for (const TestResult& r : batch)
+        {
+            ++done;
+            logResult(r);
+            if (on_complete) on_complete(r);
+        }
+        batch.clear();
+    }
+
+    sender.join();
+}
+
+/**
+ * @brief Runs one long test in chunks, reporting progress after each one.
+ *
+ * The UUT only answers once a whole request has run, so the `n_iter`
+ * iterations are sent as consecutive requests of at most `chunk`
+ * iterations, each with its own wire test ID. After every chunk a
+ * progress row is logged under the run's test ID and `on_progress` is
+ * called; with `abort_on_fail` the run stops at the first chunk in which
+ * a peripheral fails or times out. The whole run is then logged as one
+ * test, failed if any chunk failed. Several runs may go on at once from
+ * different threads, e.g. one per UUT.
+ *
+ * @param uut Index of the UUT to test.
+ * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
+ * @param n_iter Total number of iterations.
+ * @param shared Payload sent with every chunk.
+ * @param chunk Most iterations per request (at least 1).
+ * @param abort_on_fail Stop at the first failing chunk.
+ * @param on_progress Optional callback, run on the calling thread after each chunk.
+ * @return TestResult Outcome of the whole run; test_id is 0 if no test ID could be allocated.
+ */
+HardwareTester::TestResult HardwareTester::runStreaming(int uut, uint8_t flags, uint8_t n_iter, std::string_view shared,
+                                                        uint8_t chunk, bool abort_on_fail,
+                                                        const ProgressHandler& on_progress)
+{
+    TestResult result{};
+    Progress progress{0, uut, 0, n_iter, 0, false};
+    if (chunk == 0) chunk = 1;
+    if (!getNextTestId(progress.test_id))
     {
         std::cerr << "Error getting test id\n";
-        return;
+        return result;
     }
-    outMsg.test_id = test_id;
 
-    struct timeval start, end;
-    gettimeofday(&start, nullptr);
+    result.test_id = progress.test_id;
+    result.uut = uut;
+    result.flags = flags & TEST_ALL;
+    result.n_iter = n_iter;
+    auto first_sent = std::chrono::steady_clock::now();
+
+    // A run of 0 iterations is still one request
+    do
+    {
+        auto n = static_cast<uint8_t>(std::min<unsigned>(chunk, n_iter - progress.iterations));
+        Request request(flags, n, shared);
+        uint32_t chunk_id;
+        if (!submitTest(uut, request, chunk_id))
+        {
+            result.timed_out = true;
+            progress.failed = result.flags;
+            break;
+        }
 
-    sendOutMsg();
+        TestResult r = waitCompleted(chunk_id);
+        if (progress.iterations == 0) result.start = r.start;
+        result.retransmits += r.retransmits;
+        result.timed_out |= r.timed_out;
 
-    int n_threads = 0;
-    if (flags & TEST_UART) ++n_threads;
-    if (flags & TEST_SPI) ++n_threads;
-    if (flags & TEST_I2C) ++n_threads;
+        uint8_t chunk_failed = 0;
+        for (int i = 0; i < r.n_replies; ++i)
+        {
+            if (r.replies[i].test_result != TEST_SUCCESS) chunk_failed |= r.replies[i].peripheral;
+        }
+        progress.failed |= chunk_failed;
+        progress.iterations += n;
+        progress.aborted = abort_on_fail && chunk_failed && progress.iterations < n_iter;
 
-    inMsgs.resize(n_threads);
-    results.resize(n_threads);
+        try
+        {
+            logger->logProgress(progress.test_id, progress.iterations, chunk_failed, r.duration_sec);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+        }
+        if (on_progress) on_progress(progress);
+    } while (!progress.aborted && progress.iterations < n_iter);
 
-    for (int i = 0; i < n_threads; ++i) {
-        threads.emplace_back(&HardwareTester::recvInMsg, this, i);
+    for (uint8_t code : {TEST_UART, TEST_SPI, TEST_I2C})
+    {
+        if (!(result.flags & code)) continue;
+        uint8_t outcome = (progress.failed & code) ? TEST_FAILED : TEST_SUCCESS;
+        result.replies[result.n_replies++] = InMsg{result.test_id, code, outcome, 0};
     }
+    result.success = progress.failed == 0;
+    result.duration_sec = result.latency_sec =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - first_sent).count();
 
-    for (auto& t : threads) t.join();
+    if (result.start.tv_sec == 0) gettimeofday(&result.start, nullptr);
+    logResult(result);
+    lastTestId = result.test_id;
+    return result;
+}
 
-    gettimeofday(&end, nullptr);
+/**
+ * @brief Keeps a window of tests in flight on each of the first `n_uuts` UUTs.
+ *
+ * A UUT whose request cannot be sent stops receiving new tests; the others
+ * carry on. Every test is sent from the same `request`, and completions are
+ * swapped through vectors reserved for a full window and kept between
+ * runs, so once warm a run doesn't allocate at all.
+ * The tests started after each batch of completions go out in one
+ * sendmmsg call.
+ *
+ * @param n_uuts Number of UUTs to test, from the start of the list.
+ * @param request Serialized request sent for every test.
+ * @param count Number of tests to run per UUT.
+ * @param window Maximum number of outstanding tests per UUT (at least 1).
+ * @param on_complete Optional callback, run on the calling thread.
+ */
+void HardwareTester::runWindowed(size_t n_uuts, const Request& request, unsigned count, unsigned window,
+                                 const CompletionHandler& on_complete)
+{
+    if (window == 0) window = 1;
 
-    char timestamp[64];
-    formatTimestamp(timestamp, sizeof(timestamp), start);
+    windows.assign(n_uuts, WindowState{});
+    size_t total_outstanding = 0;
+    SendBatch out;
 
-    int all_success = 1;
-    for (int r : results) if (!r) all_success = 0;
+    // No more than the whole window can complete between two swaps
+    windowBatch.reserve(n_uuts * window);
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        completed.reserve(n_uuts * window);
+    }
 
-    try {
-        logger->prep();
-        logger->logTest(test_id, timestamp, elapsedSeconds(start, end), all_success);
-    } 
-    catch (const std::exception& e)
+    while (true)
     {
-        std::cerr << e.what() << "\n";
-        return;
+        for (size_t u = 0; u < n_uuts; ++u)
+        {
+            WindowState& w = windows[u];
+            while (!w.failed && w.sent < count && w.outstanding < window)
+            {
+                uint32_t test_id;
+                if (!submitTest(u, request, test_id, &out))
+                {
+                    w.failed = true;
+                    break;
+                }
+                ++w.sent;
+                ++w.outstanding;
+                ++total_outstanding;
+            }
+        }
+        flushOutMsgs(out);
+
+        if (total_outstanding == 0) break;
+
+        {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingCv.wait(lock, [&] { return !completed.empty(); });
+            windowBatch.swap(completed);
+        }
+
+        for (const TestResult& r : windowBatch)
+        {
+            --windows[r.uut].outstanding;
+            --total_outstanding;
+            logResult(r);
+            if (on_complete) on_complete(r);
+        }
+        windowBatch.clear();
+    }
+}
+
+/**
+ * @brief Sends a pattern of any length to one UUT, split over several tests.
+ *
+ * The pattern is cut into segments of OUT_MSG_MAX_PAYLOAD bytes, each sent as
+ * a test of its own, with up to `window` of them in flight. Segments are
+ * generated as they are sent, into one slot per test in flight, so memory
+ * doesn't grow with the pattern. The STM32 checks every segment it receives
+ * and only reports pass or fail, so a failure is located by the segment:
+ * its offset, length and the CRC-32C of the bytes sent are reported, and
+ * the CRC of the whole pattern identifies the run. The CRCs are only a
+ * fingerprint for reproducing a failure from the pattern's spec; nothing
+ * comes back from the UUT to compare them with. Tests are logged like
+ * those of runPipelined(), which this must not run alongside.
+ *
+ * @param uut Index of the UUT to test.
+ * @param flags Peripherals each segment is sent through.
+ * @param n_iter Iterations of every segment.
+ * @param pattern Pattern to send.
+ * @param size Pattern length in bytes; an empty pattern is still one test.
+ * @param window Maximum number of outstanding segments (at least 1).
+ * @param on_complete Optional callback for each segment's result.
+ * @return PatternResult Failed segments and totals.
+ */
+HardwareTester::PatternResult HardwareTester::runPattern(int uut, uint8_t flags, uint8_t n_iter,
+                                                         const Pattern& pattern, size_t size, unsigned window,
+                                                         const CompletionHandler& on_complete)
+{
+    PatternResult result{size, 0, std::max<size_t>(1, (size + OUT_MSG_MAX_PAYLOAD - 1) / OUT_MSG_MAX_PAYLOAD),
+                         0, {}, 0};
+    if (window == 0) window = 1;
+    window = static_cast<unsigned>(std::min<size_t>(window, result.segments));
+
+    // Requests of the segments in flight, and the segment each slot holds.
+    // Pending tests point into slots, so it's never grown past its reserve.
+    std::vector<Request> slots;
+    std::vector<size_t> segment_in(window);
+    std::vector<unsigned> free_slots;
+    slots.reserve(window);
+    free_slots.reserve(window);
+
+    std::unordered_map<uint32_t, unsigned> slot_of;
+    Pattern::Stream stream(pattern);
+    char bytes[OUT_MSG_MAX_PAYLOAD];
+    size_t next = 0, outstanding = 0;
+    bool failed_send = false;
+    SendBatch out;
+    auto first_sent = std::chrono::steady_clock::now();
+
+    windowBatch.reserve(window);
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        completed.reserve(window);
     }
+
+    while (true)
+    {
+        while (!failed_send && next < result.segments && outstanding < window)
+        {
+            size_t len = std::min<size_t>(OUT_MSG_MAX_PAYLOAD, size - next * OUT_MSG_MAX_PAYLOAD);
+            stream.read(bytes, len);
+            result.crc = Pattern::crc32c(bytes, len, result.crc);
+
+            unsigned slot;
+            if (free_slots.empty())
+            {
+                slot = slots.size();
+                slots.emplace_back(flags, n_iter, std::string_view(bytes, len));
+            }
+            else
+            {
+                slot = free_slots.back();
+                free_slots.pop_back();
+                slots[slot] = Request(flags, n_iter, std::string_view(bytes, len));
+            }
+            segment_in[slot] = next++;
+
+            uint32_t test_id;
+            if (!submitTest(uut, slots[slot], test_id, &out))
+            {
+                failed_send = true;
+                free_slots.push_back(slot);
+                break;
+            }
+            slot_of[test_id] = slot;
+            ++outstanding;
+        }
+        flushOutMsgs(out);
+
+        if (outstanding == 0) break;
+
+        {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingCv.wait(lock, [&] { return !completed.empty(); });
+            windowBatch.swap(completed);
+        }
+
+        for (const TestResult& r : windowBatch)
+        {
+            --outstanding;
+            ++result.completed;
+            logResult(r);
+            if (on_complete) on_complete(r);
+
+            auto it = slot_of.find(r.test_id);
+            unsigned slot = it->second;
+            slot_of.erase(it);
+            free_slots.push_back(slot);
+            if (r.success) continue;
+
+            // Peripherals that never replied count as failed too
+            uint8_t passed = 0;
+            for (int i = 0; i < r.n_replies; ++i)
+            {
+                if (r.replies[i].test_result == TEST_SUCCESS) passed |= r.replies[i].peripheral;
+            }
+            std::string_view sent = slots[slot].payload();
+            result.failures.push_back(PatternSegment{segment_in[slot] * OUT_MSG_MAX_PAYLOAD, sent.size(),
+                                                     r.test_id, static_cast<uint8_t>(r.flags & ~passed),
+                                                     Pattern::crc32c(sent.data(), sent.size())});
+        }
+        windowBatch.clear();
+    }
+    result.duration_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - first_sent).count();
+
+    // Segments that were never sent still count towards the pattern's CRC
+    for (size_t done = std::min(size, next * OUT_MSG_MAX_PAYLOAD); done < size; done += OUT_MSG_MAX_PAYLOAD)
+    {
+        size_t len = std::min<size_t>(OUT_MSG_MAX_PAYLOAD, size - done);
+        stream.read(bytes, len);
+        result.crc = Pattern::crc32c(bytes, len, result.crc);
+    }
+
+    std::sort(result.failures.begin(), result.failures.end(),
+              [](const PatternSegment& a, const PatternSegment& b) { return a.offset < b.offset; });
+
+    return result;
 }
 
 /**
@@ -149,8 +630,7 @@ std::string HardwareTester::strLast()
 {
     try
     {
-        logger->prep();
-        return logger->strById(outMsg.test_id);
+        return logger->strById(lastTestId);
     } 
     catch (const std::exception& e)
     {
@@ -160,85 +640,1026 @@ std::string HardwareTester::strLast()
     return std::string("Error getting last test's result");
 }
 
+/**
+ * @brief Serializes the parts of an OutMsg that are the same for every test.
+ *
+ * Wire format (a version 1 OutMsg, see include/wire.h): test_id (4 bytes,
+ * little-endian), peripheral, n_iter, p_len, then p_len payload bytes.
+ *
+ * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
+ * @param n_iter Number of iterations each test should run.
+ * @param payload Payload; longer ones are truncated to OUT_MSG_MAX_PAYLOAD bytes.
+ */
+HardwareTester::Request::Request(uint8_t flags, uint8_t n_iter, std::string_view payload)
+    : p_len(std::min(payload.size(), (size_t)OUT_MSG_MAX_PAYLOAD))
+{
+    std::memset(header, 0, sizeof(uint32_t));
+    header[4] = flags;
+    header[5] = n_iter;
+    header[6] = p_len;
+    std::memcpy(body, payload.data(), p_len);
+}
+
+/**
+ * @brief Starts a test without waiting for it.
+ *
+ * The result is logged and passed to `on_complete` by the next call to
+ * processCompletions() after the test completes, on that caller's thread.
+ * May be called from any thread, including from inside a handler.
+ *
+ * @param uut Index of the UUT to test.
+ * @param request Request to send; must stay valid until `on_complete` runs.
+ * @param on_complete Called once with the result.
+ * @return true if the request was sent.
+ * @return false if it wasn't; `on_complete` is then never called.
+ */
+bool HardwareTester::submitAsync(int uut, const Request& request, CompletionHandler on_complete)
+{
+    uint32_t test_id;
+    ++nAsync;
+    if (!submitTest(uut, request, test_id, nullptr, std::move(on_complete)))
+    {
+        --nAsync;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Starts a test from a coroutine: `TestResult r = co_await tester.runTestAsync(...)`.
+ *
+ * @param uut Index of the UUT to test.
+ * @param flags Bitmask indicating which tests to run (UART, SPI, I2C).
+ * @param n_iter Number of iterations each test should run.
+ * @param shared Payload to send with the test request.
+ * @return TestAwaiter Resumes the coroutine from processCompletions().
+ */
+HardwareTester::TestAwaiter HardwareTester::runTestAsync(int uut, uint8_t flags, uint8_t n_iter, std::string_view shared)
+{
+    return TestAwaiter(*this, uut, flags, n_iter, shared);
+}
+
+/**
+ * @brief Returns a descriptor that is readable while async results are waiting.
+ *
+ * Lets an existing event loop watch it with poll/epoll and call
+ * processCompletions() when it becomes readable.
+ */
+int HardwareTester::completionFd() const
+{
+    return readyFd;
+}
+
+/**
+ * @brief Logs completed async tests and runs their handlers.
+ *
+ * Handlers run on the calling thread; call it from one thread at a time.
+ *
+ * @param timeout_ms How long to wait for a completion if none is ready:
+ *                   0 returns at once, -1 waits indefinitely.
+ * @return size_t Number of handlers run.
+ */
+size_t HardwareTester::processCompletions(int timeout_ms)
+{
+    if (timeout_ms != 0)
+    {
+        struct pollfd pfd = {readyFd, POLLIN, 0};
+        if (::poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) perror("poll");
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        uint64_t val;
+        if (read(readyFd, &val, sizeof(val)) < 0 && errno != EAGAIN) perror("read");
+        readyBatch.swap(ready);
+    }
+
+    for (auto& [result, handler] : readyBatch)
+    {
+        logResult(result);
+        --nAsync;
+        handler(result);
+    }
+    size_t n = readyBatch.size();
+    readyBatch.clear();
+    return n;
+}
+
+/**
+ * @brief Returns the number of async tests whose handler hasn't run yet.
+ *
+ */
+size_t HardwareTester::asyncOutstanding() const
+{
+    return nAsync;
+}
+
+HardwareTester::TestAwaiter::TestAwaiter(HardwareTester& tester, int uut, uint8_t flags, uint8_t n_iter,
+                                         std::string_view shared)
+    : tester(tester), uut(uut), request(flags, n_iter, shared), result{}
+{}
+
+/**
+ * @brief Sends the test and arranges for `handle` to be resumed with its result.
+ *
+ * @return true if the coroutine stays suspended until the test completes.
+ * @return false if the test could not be sent.
+ */
+bool HardwareTester::TestAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    return tester.submitAsync(uut, request, [this, handle](const TestResult& r) {
+        result = r;
+        handle.resume();
+    });
+}
 
 /**
- * @brief Sends the prepared OutMsg structure over UDP.
+ * @brief Asks a bridge how long its tasks have spent handling packets.
  *
- * Serializes the `outMsg` into a byte buffer and sends it to the UUT.
+ * Sends a datagram holding only TIMING_TEST_ID, which the bridge answers
+ * itself instead of forwarding it to the STM32. Tests may run meanwhile.
  *
- * @throws std::runtime_error if `sendto` fails.
+ * @param uut Index of the UUT to query.
+ * @param timing Set to the bridge's counters.
+ * @param timeout_ms How long to wait for the reply.
+ * @return true if a reply arrived in time.
+ * @return false on timeout or send error.
  */
-void HardwareTester::sendOutMsg()
+bool HardwareTester::queryBridgeTiming(int uut, BridgeTiming& timing, int timeout_ms)
 {
-    char buf[BUFSIZE];
-    size_t n_bytes = 0;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        uuts[uut].timingReady = false;
+    }
 
-    std::memcpy(&buf[n_bytes], &outMsg.test_id, sizeof(outMsg.test_id));
-    n_bytes += sizeof(outMsg.test_id);
+    if (!sendControl(uut, TIMING_TEST_ID)) return false;
 
-    buf[n_bytes++] = outMsg.peripheral;
-    buf[n_bytes++] = outMsg.n_iter;
-    buf[n_bytes++] = outMsg.p_len;
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    if (!pendingCv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return uuts[uut].timingReady; }))
+    {
+        return false;
+    }
+    timing = uuts[uut].timing;
+    return true;
+}
+
+/**
+ * @brief Asks a bridge for a snapshot of its counters.
+ *
+ * Sends a datagram holding only STATS_TEST_ID, which the bridge answers
+ * itself, so a bridge that is dropping packets or running low on stack
+ * can be spotted without a serial console. Tests may run meanwhile.
+ *
+ * @param uut Index of the UUT to query.
+ * @param out Set to the bridge's counters.
+ * @param timeout_ms How long to wait for the reply.
+ * @return true if a reply arrived in time.
+ * @return false on timeout or send error.
+ */
+bool HardwareTester::stats(int uut, BridgeStats& out, int timeout_ms)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        uuts[uut].statsReady = false;
+    }
+
+    if (!sendControl(uut, STATS_TEST_ID)) return false;
 
-    if (outMsg.p_len > 0) {
-        std::memcpy(&buf[n_bytes], outMsg.payload, outMsg.p_len);
-        n_bytes += outMsg.p_len;
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    if (!pendingCv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return uuts[uut].statsReady; }))
+    {
+        return false;
     }
+    out = uuts[uut].bridgeStats;
+    return true;
+}
 
-    if (sendto(sock, buf, n_bytes, 0, (struct sockaddr *)&sockAddr, sizeof(sockAddr)) != (ssize_t)n_bytes)
+/**
+ * @brief Sends a datagram holding only a reserved test_id to a bridge.
+ *
+ * @param uut Index of the destination UUT.
+ * @param tag TIMING_TEST_ID or STATS_TEST_ID.
+ * @return true if the datagram was sent.
+ */
+bool HardwareTester::sendControl(int uut, uint32_t tag)
+{
+    char buf[sizeof(uint32_t)];
+    wire_put_u32(buf, tag);
+    const sockaddr_in& addr = uuts[uut].addr;
+    if (sendto(sock, buf, sizeof(buf), 0, (const struct sockaddr *)&addr, sizeof(addr)) != sizeof(buf))
     {
         perror("sendto");
-        throw std::runtime_error("sendOutMsg: sendto failed");
+        return false;
     }
+    return true;
 }
 
 /**
- * @brief Receives a single InMsg from the UUT and stores it in the indexed slot.
+ * @brief Prints p50/p90/p99/p999 of each stage of the tests run so far.
  *
- * Waits to receive a 6-byte response and parses it into an `InMsg` structure.
+ * Stages, measured on the monotonic clock: test ID allocation, sending,
+ * first and last reply (from the last transmission), the bridge's share
+ * of the round trip (version 2 replies only), the logTest() call and the
+ * logger's database commits. Queued log records are flushed
+ * first so their commits are counted.
  *
- * @param idx Index in the results/inMsgs array to store the parsed result.
+ * @param out Stream to print to.
  */
-void HardwareTester::recvInMsg(int idx)
+void HardwareTester::printLatency(std::ostream& out)
 {
-    sockaddr_in from;
-    socklen_t from_len = sizeof(from);
-    char recv_buf[IN_MSG_SIZE];
+    logger->flush();
+    idAllocLatency.print(out, "id_alloc");
+    sendLatency.print(out, "send");
+    firstReplyLatency.print(out, "first_reply");
+    lastReplyLatency.print(out, "last_reply");
+    if (bridgeLatency.count()) bridgeLatency.print(out, "bridge");
+    logLatency.print(out, "log");
+    logger->commitLatency().print(out, "db_commit");
+}
 
-    int n = recvfrom(sock, recv_buf, sizeof(recv_buf), 0, (sockaddr *)&from, &from_len);
-    if (n != IN_MSG_SIZE) {
-        perror("recvfrom");
-        return;
+/**
+ * @brief Writes the same summary as printLatency() as one JSON object.
+ *
+ * @param out Stream to write to.
+ */
+void HardwareTester::writeLatencyJson(std::ostream& out)
+{
+    logger->flush();
+    const std::pair<const char *, const LatencyHistogram *> stages[] = {
+        {"id_alloc", &idAllocLatency},
+        {"send", &sendLatency},
+        {"first_reply", &firstReplyLatency},
+        {"last_reply", &lastReplyLatency},
+        {"bridge", &bridgeLatency},
+        {"log", &logLatency},
+        {"db_commit", &logger->commitLatency()},
+    };
+
+    out << "{";
+    for (size_t i = 0; i < std::size(stages); ++i)
+    {
+        out << (i ? ", " : "") << "\"" << stages[i].first << "\": ";
+        stages[i].second->writeJson(out);
+    }
+    out << "}\n";
+}
+
+/**
+ * @brief Makes test results be logged by a background writer thread.
+ *
+ * Useful for long runs: `runTests` then no longer waits for the database.
+ * Results are flushed before `strLast` reads them and on destruction.
+ *
+ * @param flush_interval Maximum time a result waits before being committed.
+ */
+void HardwareTester::startAsyncLogging(std::chrono::milliseconds flush_interval)
+{
+    logger->startAsync(flush_interval);
+}
+
+
+/**
+ * @brief Allocates a test ID, registers the test as pending and sends it.
+ *
+ * @param uut Index of the UUT to test.
+ * @param request Request to send; must stay valid until the test completes.
+ * @param test_id Set to the ID of the submitted test.
+ * @param batch If set, the OutMsg is only queued; the caller sends it with
+ *              flushOutMsgs(), and a failed send is then retried at the
+ *              test's deadline like a lost request.
+ * @param on_complete If set, the result is delivered through processCompletions().
+ * @param intended When the test was scheduled to be sent; latency_sec is
+ *                 measured from here. Defaults to the actual send time.
+ * @return true if the request was sent (or queued).
+ * @return false if no test ID could be allocated or sending failed.
+ */
+bool HardwareTester::submitTest(int uut, const Request& request, uint32_t& test_id, SendBatch *batch,
+                                CompletionHandler on_complete, std::chrono::steady_clock::time_point intended)
+{
+    auto t_start = std::chrono::steady_clock::now();
+    if (!getNextTestId(test_id))
+    {
+        std::cerr << "Error getting test id\n";
+        return false;
+    }
+    lastTestId = test_id;
+    auto t_id = std::chrono::steady_clock::now();
+    idAllocLatency.record(t_id - t_start);
+
+    char header[OUT_MSG_HDR_SIZE];
+    std::memcpy(header, request.header, OUT_MSG_HDR_SIZE);
+    wire_put_u32(header, test_id);
+
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        PendingTest& p = addPending(test_id);
+        p.uut = uut;
+        p.expected = request.flags() & TEST_ALL;
+        p.received = 0;
+        gettimeofday(&p.start, nullptr);
+        p.sent_at = p.first_sent = std::chrono::steady_clock::now();
+        p.intended = intended == std::chrono::steady_clock::time_point{} ? p.first_sent : intended;
+        p.deadline = p.sent_at + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                     std::chrono::duration<double>(uuts[uut].rto));
+        p.retransmits = 0;
+        std::memcpy(p.header, header, OUT_MSG_HDR_SIZE);
+        p.request = &request;
+        p.on_complete = std::move(on_complete);
+
+        // The receiver sleeps until the earliest deadline it knows of
+        if (p.deadline < pollUntil)
+        {
+            pollUntil = p.deadline;
+            wakeReceiver();
+        }
+    }
+
+    if (batch)
+    {
+        queueOutMsg(*batch, uut, header, request);
+    }
+    else
+    {
+        try
+        {
+            sendOutMsg(uut, header, request);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << "\n";
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            removePending(pending.find(test_id));
+            return false;
+        }
+    }
+    sendLatency.record(std::chrono::steady_clock::now() - t_id);
+
+    // Nothing to wait for
+    if ((request.flags() & TEST_ALL) == 0)
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        complete(test_id);
     }
 
-    InMsg& msg = inMsgs[idx];
-    std::memcpy(&msg.test_id, &recv_buf[0], sizeof(uint32_t));
-    msg.peripheral = recv_buf[4];
-    msg.test_result = recv_buf[5];
+    return true;
+}
+
+/**
+ * @brief Waits until the receiver thread has completed a test and takes its result.
+ *
+ * @param test_id ID of a test sent with submitTest(), without a completion handler.
+ * @return TestResult The test's result, removed from `completed`.
+ */
+HardwareTester::TestResult HardwareTester::waitCompleted(uint32_t test_id)
+{
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    auto done = completed.end();
+    pendingCv.wait(lock, [&] {
+        done = std::find_if(completed.begin(), completed.end(),
+                            [&](const TestResult& r) { return r.test_id == test_id; });
+        return done != completed.end();
+    });
 
-    results[idx] = (msg.test_result == TEST_SUCCESS);
+    TestResult result = *done;
+    completed.erase(done);
+    return result;
 }
 
 /**
- * @brief Retrieves the next available test ID from the logger.
+ * @brief Inserts an entry for `test_id` into `pending`, reusing a spare node if any.
  *
- * Calls `prep()` and then queries the next test ID.
+ * @attention pendingMutex must be held by the caller
  *
- * @param id Reference to store the result.
- * @return true if the operation succeeded.
- * @return false if an exception occurred.
+ * @param test_id ID of the new test.
+ * @return PendingTest& The entry; all fields must be set by the caller.
  */
-bool HardwareTester::getNextTestId(uint32_t &id)
+HardwareTester::PendingTest& HardwareTester::addPending(uint32_t test_id)
+{
+    if (spareNodes.empty()) return pending[test_id];
+
+    PendingMap::node_type node = std::move(spareNodes.back());
+    spareNodes.pop_back();
+    node.key() = test_id;
+    return pending.insert(std::move(node)).position->second;
+}
+
+/**
+ * @brief Removes a test from `pending`, keeping its node for the next test.
+ *
+ * @attention pendingMutex must be held by the caller
+ *
+ * @param it Entry in `pending`.
+ */
+void HardwareTester::removePending(PendingMap::iterator it)
+{
+    it->second.on_complete = nullptr;
+    spareNodes.push_back(pending.extract(it));
+}
+
+/**
+ * @brief Writes a completed test to the logger.
+ *
+ * @param result Completed test.
+ */
+void HardwareTester::logResult(const TestResult& result)
 {
+    if (result.timed_out)
+    {
+        std::cerr << "Test " << result.test_id << " timed out after "
+                  << result.retransmits << " retransmissions\n";
+    }
+
+    char timestamp[64];
+    formatTimestamp(timestamp, sizeof(timestamp), result.start);
+
     try
     {
-        logger->prep();
-    } catch (const std::exception& e)
+        auto start = std::chrono::steady_clock::now();
+        TestContext context{static_cast<int64_t>(result.start.tv_sec) * 1000000 + result.start.tv_usec,
+                            uuts[result.uut].name.c_str(), result.flags, result.n_iter};
+        logger->logTest(result.test_id, timestamp, result.duration_sec, result.success, context);
+        logLatency.record(std::chrono::steady_clock::now() - start);
+    }
+    catch (const std::exception& e)
     {
         std::cerr << e.what() << "\n";
-        return false;
     }
+}
+
+/**
+ * @brief Sends an OutMsg to a UUT over UDP.
+ *
+ * The header and the payload are gathered by `sendmsg` from where they
+ * already are, without assembling them in one buffer first. With
+ * BRIDGE_WIRE_V2 the test goes out as a version 2 request of one test.
+ *
+ * @param uut Index of the destination UUT.
+ * @param header OutMsg header carrying the test ID.
+ * @param request Request holding the payload.
+ * @throws std::runtime_error if `sendmsg` fails.
+ */
+void HardwareTester::sendOutMsg(int uut, const char *header, const Request& request)
+{
+    struct iovec iov[3];
+    iov[0].iov_base = const_cast<char *>(header);
+    iov[0].iov_len = OUT_MSG_HDR_SIZE;
+    iov[1].iov_base = const_cast<char *>(request.body);
+    iov[1].iov_len = request.p_len;
+
+    struct msghdr msg = {};
+    msg.msg_name = &uuts[uut].addr;
+    msg.msg_namelen = sizeof(uuts[uut].addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = request.p_len > 0 ? 2 : 1;
+
+#if BRIDGE_WIRE_V2
+    char req_header[WIRE_REQ_HDR_SIZE];
+    wire_put_req_hdr(req_header, 1, request.p_len);
+    iov[0].iov_base = req_header;
+    iov[2].iov_base = const_cast<char *>(header);
+    iov[2].iov_len = WIRE_TEST_SIZE;
+    msg.msg_iovlen = 3;
+#endif
+
+    size_t expected = 0;
+    for (size_t i = 0; i < msg.msg_iovlen; ++i) expected += iov[i].iov_len;
+
+    if (sendmsg(sock, &msg, 0) != (ssize_t)expected)
+    {
+        perror("sendmsg");
+        throw std::runtime_error("sendOutMsg: sendmsg failed");
+    }
+}
+
+/**
+ * @brief Adds an OutMsg to a batch, sending the batch first if it is full.
+ *
+ * The header is copied into the batch; the payload is referenced in
+ * `request`, which must stay valid until the batch is flushed. With
+ * BRIDGE_WIRE_V2, a test for the same UUT and request as the previous
+ * datagram is appended to it as one more test entry.
+ *
+ * @param batch Batch to add to.
+ * @param uut Index of the destination UUT.
+ * @param header OutMsg header carrying the test ID.
+ * @param request Request holding the payload.
+ */
+void HardwareTester::queueOutMsg(SendBatch& batch, int uut, const char *header, const Request& request)
+{
+#if BRIDGE_WIRE_V2
+    if (batch.n > 0)
+    {
+        unsigned last = batch.n - 1;
+        uint8_t n_tests = batch.headers[last][5];
+        if (batch.uuts[last] == uut && batch.requests[last] == &request && n_tests < WIRE_MAX_TESTS)
+        {
+            std::memcpy(&batch.tests[last][n_tests * WIRE_TEST_SIZE], header, WIRE_TEST_SIZE);
+            wire_put_req_hdr(batch.headers[last], n_tests + 1, request.p_len);
+            batch.iov[last][2].iov_len += WIRE_TEST_SIZE;
+            return;
+        }
+    }
+#endif
+
+    if (batch.n == SEND_BATCH) flushOutMsgs(batch);
+
+    unsigned i = batch.n++;
+    batch.uuts[i] = uut;
+    batch.requests[i] = &request;
+    std::memcpy(batch.headers[i], header, OUT_MSG_HDR_SIZE);
+    batch.iov[i][0].iov_base = batch.headers[i];
+    batch.iov[i][0].iov_len = OUT_MSG_HDR_SIZE;
+    batch.iov[i][1].iov_base = const_cast<char *>(request.body);
+    batch.iov[i][1].iov_len = request.p_len;
+
+    struct msghdr& msg = batch.msgs[i].msg_hdr;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &uuts[uut].addr;
+    msg.msg_namelen = sizeof(uuts[uut].addr);
+    msg.msg_iov = batch.iov[i];
+    msg.msg_iovlen = request.p_len > 0 ? 2 : 1;
+
+#if BRIDGE_WIRE_V2
+    // The test entry is the OutMsg header without p_len
+    std::memcpy(batch.tests[i], header, WIRE_TEST_SIZE);
+    wire_put_req_hdr(batch.headers[i], 1, request.p_len);
+    batch.iov[i][2].iov_base = batch.tests[i];
+    batch.iov[i][2].iov_len = WIRE_TEST_SIZE;
+    msg.msg_iovlen = 3;
+#endif
+}
+
+/**
+ * @brief Sends all queued OutMsgs with as few sendmmsg calls as possible.
+ *
+ * A message the kernel refuses is reported and skipped; its test stays
+ * pending and is resent at its deadline.
+ *
+ * @param batch Batch to send; empty afterwards.
+ */
+void HardwareTester::flushOutMsgs(SendBatch& batch)
+{
+    unsigned sent = 0;
+    while (sent < batch.n)
+    {
+        int rc = sendmmsg(sock, &batch.msgs[sent], batch.n - sent, 0);
+        if (rc < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            ++sent;
+            continue;
+        }
+        sent += rc;
+    }
+    batch.n = 0;
+}
+
+/**
+ * @brief Receiver thread body: reads every reply arriving on the socket.
+ *
+ * Polls the socket together with `wakeFd`, drains all queued datagrams on
+ * each wakeup, RECV_BATCH at a time with recvmmsg, and hands them to
+ * `dispatch`. Between reads it resends or
+ * expires tests whose deadline passed, and sleeps no longer than the next
+ * deadline; `wakeFd` interrupts the sleep when a test with an earlier
+ * deadline is submitted or `stopReceiver` is called.
+ */
+void HardwareTester::recvLoop()
+{
+    char slots[RECV_BATCH][RECV_SLOT_SIZE];
+    struct iovec iov[RECV_BATCH];
+    struct mmsghdr msgs[RECV_BATCH];
+    sockaddr_in from[RECV_BATCH];
+    struct pollfd fds[2] = {{sock, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+
+    for (int i = 0; i < RECV_BATCH; ++i)
+    {
+        iov[i].iov_base = slots[i];
+        iov[i].iov_len = RECV_SLOT_SIZE;
+    }
+
+    while (true)
+    {
+        int timeout_ms = checkDeadlines();
+        int rc = ::poll(fds, 2, timeout_ms);
+        if (rc == 0) continue;
+        if (rc < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return;
+        }
+
+        if (fds[1].revents)
+        {
+            uint64_t val;
+            if (read(wakeFd, &val, sizeof(val)) < 0 && errno != EAGAIN) perror("read");
+            if (stopping) return;
+        }
+
+        while (true)
+        {
+            for (int i = 0; i < RECV_BATCH; ++i)
+            {
+                std::memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+                msgs[i].msg_hdr.msg_name = &from[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int n = recvmmsg(sock, msgs, RECV_BATCH, MSG_DONTWAIT, nullptr);
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmmsg");
+                break;
+            }
+
+            for (int i = 0; i < n; ++i)
+            {
+                if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                {
+                    std::cerr << "recvLoop: oversized reply dropped\n";
+                    continue;
+                }
+                dispatch(slots[i], msgs[i].msg_len, from[i]);
+            }
+            if (n < RECV_BATCH) break;
+        }
+    }
+}
+
+/**
+ * @brief Parses a datagram from the UUT into InMsgs.
+ *
+ * A plain reply is a 6-byte InMsg or a version 2 reply holding several
+ * results. With BRIDGE_BATCHING, each datagram holds one or more such
+ * frames, each preceded by its length as a 16-bit little-endian value;
+ * frames of neither kind are skipped.
+ *
+ * @param buf Received datagram.
+ * @param len Datagram length in bytes.
+ * @param from Source address of the datagram.
+ */
+void HardwareTester::dispatch(const char *buf, int len, const sockaddr_in& from)
+{
+    if (len >= (int)sizeof(uint32_t) && wire_get_u32(buf) == TIMING_TEST_ID)
+    {
+        handleTiming(buf, len, from);
+        return;
+    }
+    if (len >= (int)sizeof(uint32_t) && wire_get_u32(buf) == STATS_TEST_ID)
+    {
+        handleStats(buf, len, from);
+        return;
+    }
+
+    auto parse = [this, &from](const char *p, int n) {
+        if (n >= (int)sizeof(uint32_t) && wire_get_u32(p) == WIRE_V2_ID)
+        {
+            handleReply(p, n, from);
+            return;
+        }
+        if (n != WIRE_IN_MSG_SIZE)
+        {
+            std::cerr << "dispatch: unexpected reply of " << n << " bytes\n";
+            return;
+        }
+        wire_test_t t = wire_get_in_msg(p);
+        handleInMsg(InMsg{t.test_id, t.peripheral, t.value, 0}, from);
+    };
+
+#if BRIDGE_BATCHING
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(buf);
+    int pos = 0;
+    while (pos + 2 <= len)
+    {
+        int frame_len = u[pos] | (u[pos + 1] << 8);
+        pos += 2;
+        if (pos + frame_len > len)
+        {
+            std::cerr << "dispatch: truncated frame\n";
+            return;
+        }
+        parse(&buf[pos], frame_len);
+        pos += frame_len;
+    }
+#else
+    parse(buf, len);
+#endif
+}
+
+/**
+ * @brief Hands each result of a version 2 reply to handleInMsg().
+ *
+ * @param buf Reply, starting with WIRE_V2_ID.
+ * @param len Reply length in bytes.
+ * @param from Source address of the reply.
+ */
+void HardwareTester::handleReply(const char *buf, int len, const sockaddr_in& from)
+{
+    int n = wire_check_reply(buf, len);
+    if (n < 0)
+    {
+        std::cerr << "dispatch: malformed version 2 reply of " << len << " bytes\n";
+        return;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        wire_test_t t = wire_get_result(buf, i);
+        handleInMsg(InMsg{t.test_id, t.peripheral, t.value, t.bridge_us}, from);
+    }
+}
+
+/**
+ * @brief Stores a reply in the slot of its test and peripheral.
+ *
+ * Replies for unknown tests (e.g. late duplicates), from a UUT other than
+ * the one the test was sent to, and for peripherals that were not
+ * requested are dropped. The UUT is matched by IP address only: the bridge
+ * sends test replies from an unbound socket, so from an ephemeral port.
+ *
+ * @param msg Parsed reply.
+ * @param from Source address of the reply.
+ */
+void HardwareTester::handleInMsg(const InMsg& msg, const sockaddr_in& from)
+{
+    int slot = slotOf(msg.peripheral);
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    auto it = pending.find(msg.test_id);
+    if (it == pending.end() || slot < 0 || !(it->second.expected & msg.peripheral)) return;
+
+    PendingTest& p = it->second;
+    if (from.sin_addr.s_addr != uuts[p.uut].addr.sin_addr.s_addr) return;
+
+    if (p.received == 0) firstReplyLatency.record(std::chrono::steady_clock::now() - p.sent_at);
+    if (msg.bridge_us) bridgeLatency.record(uint64_t(msg.bridge_us) * 1000);
+    p.replies[slot] = msg;
+    p.received |= msg.peripheral;
+    if (p.received == p.expected) complete(msg.test_id);
+}
+
+/**
+ * @brief Stores a bridge's timing reply and wakes queryBridgeTiming().
+ *
+ * @param buf Received datagram, starting with TIMING_TEST_ID.
+ * @param len Datagram length in bytes.
+ * @param from Source address of the reply.
+ */
+void HardwareTester::handleTiming(const char *buf, int len, const sockaddr_in& from)
+{
+    if (len != TIMING_REPLY_SIZE)
+    {
+        std::cerr << "dispatch: unexpected timing reply of " << len << " bytes\n";
+        return;
+    }
+
+    BridgeTiming t;
+    size_t pos = sizeof(uint32_t);
+    for (BridgeTiming::Task *task : {&t.ntou, &t.utx, &t.uton})
+    {
+        task->count = wire_get_u32(&buf[pos]);
+        task->max_us = wire_get_u32(&buf[pos + 4]);
+        task->busy_us = wire_get_u64(&buf[pos + 8]);
+        pos += 16;
+    }
+    t.uptime_us = wire_get_u64(&buf[pos]);
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    for (Uut& uut : uuts)
+    {
+        if (uut.addr.sin_addr.s_addr == from.sin_addr.s_addr && uut.addr.sin_port == from.sin_port)
+        {
+            uut.timing = t;
+            uut.timingReady = true;
+            pendingCv.notify_all();
+        }
+    }
+}
+
+/**
+ * @brief Stores a bridge's stats reply and wakes stats().
+ *
+ * @param buf Received datagram, starting with STATS_TEST_ID.
+ * @param len Datagram length in bytes.
+ * @param from Source address of the reply.
+ */
+void HardwareTester::handleStats(const char *buf, int len, const sockaddr_in& from)
+{
+    BridgeStats s;
+    if (wire_get_stats(buf, len, &s) < 0)
+    {
+        std::cerr << "dispatch: unexpected stats reply of " << len << " bytes\n";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    for (Uut& uut : uuts)
+    {
+        if (uut.addr.sin_addr.s_addr == from.sin_addr.s_addr && uut.addr.sin_port == from.sin_port)
+        {
+            uut.bridgeStats = s;
+            uut.statsReady = true;
+            pendingCv.notify_all();
+        }
+    }
+}
+
+/**
+ * @brief Moves a pending test with all replies to the completion queue.
+ *
+ * Tests of the async API go to `ready` instead, for processCompletions().
+ *
+ * @attention pendingMutex must be held by the caller
+ *
+ * @param test_id ID of a test in `pending`.
+ */
+void HardwareTester::complete(uint32_t test_id, bool timed_out)
+{
+    auto it = pending.find(test_id);
+    PendingTest& p = it->second;
+
+    TestResult r;
+    r.test_id = test_id;
+    r.uut = p.uut;
+    r.flags = p.expected;
+    r.n_iter = static_cast<uint8_t>(p.header[5]);
+    r.n_replies = 0;
+    r.success = !timed_out;
+    r.timed_out = timed_out;
+    r.retransmits = p.retransmits;
+    r.start = p.start;
+
+    for (uint8_t code : {TEST_UART, TEST_SPI, TEST_I2C})
+    {
+        if (!(p.expected & code)) continue;
+        InMsg msg = p.replies[slotOf(code)];
+        if (!(p.received & code)) msg = InMsg{test_id, code, 0, 0};
+        r.replies[r.n_replies++] = msg;
+        if (msg.test_result != TEST_SUCCESS) r.success = false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    r.duration_sec = std::chrono::duration<double>(now - p.first_sent).count();
+    r.latency_sec = std::chrono::duration<double>(now - p.intended).count();
+    if (!timed_out && p.expected) lastReplyLatency.record(now - p.sent_at);
+
+    // Karn's algorithm: a resent test's reply can't be matched to one send
+    if (!timed_out && p.retransmits == 0 && p.expected)
+    {
+        updateRto(uuts[p.uut], std::chrono::duration<double>(now - p.sent_at).count());
+    }
+
+    if (p.on_complete)
+    {
+        ready.emplace_back(r, std::move(p.on_complete));
+        uint64_t one = 1;
+        if (write(readyFd, &one, sizeof(one)) < 0) perror("write");
+        removePending(it);
+        return;
+    }
+
+    removePending(it);
+    completed.push_back(r);
+    pendingCv.notify_all();
+}
+
+/**
+ * @brief Resends or expires pending tests whose deadline has passed.
+ *
+ * Each resend doubles the test's deadline (up to RTO_MAX_MS). After
+ * MAX_RETRANSMITS resends the test completes as timed out, with missing
+ * replies marked as failed. The pending table is only scanned once the
+ * earliest known deadline has passed, so replies from a large fleet don't
+ * each cost a pass over every outstanding test.
+ *
+ * @return int Milliseconds until the next deadline, or -1 if none.
+ */
+int HardwareTester::checkDeadlines()
+{
+    using namespace std::chrono;
+    auto now = steady_clock::now();
+    auto next = steady_clock::time_point::max();
+    std::vector<uint32_t> expired;
+    SendBatch resends;
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (now < pollUntil)
+    {
+        if (pollUntil == steady_clock::time_point::max()) return -1;
+        return static_cast<int>(duration_cast<milliseconds>(pollUntil - now).count()) + 1;
+    }
+
+    for (auto& [test_id, p] : pending)
+    {
+        if (p.deadline <= now)
+        {
+            if (p.retransmits >= MAX_RETRANSMITS)
+            {
+                expired.push_back(test_id);
+                continue;
+            }
+
+            ++p.retransmits;
+            double backoff = std::min(uuts[p.uut].rto * (1 << p.retransmits), RTO_MAX_MS / 1000.0);
+            p.sent_at = now;
+            p.deadline = now + duration_cast<steady_clock::duration>(duration<double>(backoff));
+            queueOutMsg(resends, p.uut, p.header, *p.request);
+        }
+        next = std::min(next, p.deadline);
+    }
+
+    flushOutMsgs(resends);
+    for (uint32_t test_id : expired) complete(test_id, true);
+
+    pollUntil = next;
+    if (next == steady_clock::time_point::max()) return -1;
+    return static_cast<int>(duration_cast<milliseconds>(next - now).count()) + 1;
+}
+
+/**
+ * @brief Folds an RTT sample into a UUT's smoothed estimate and recomputes its RTO.
+ *
+ * @attention pendingMutex must be held by the caller
+ *
+ * @param uut UUT the sample was measured on.
+ * @param sample_sec Measured round trip in seconds.
+ */
+void HardwareTester::updateRto(Uut& uut, double sample_sec)
+{
+    if (!uut.haveRtt)
+    {
+        uut.srtt = sample_sec;
+        uut.rttvar = sample_sec / 2;
+        uut.haveRtt = true;
+    }
+    else
+    {
+        uut.rttvar = 0.75 * uut.rttvar + 0.25 * std::abs(uut.srtt - sample_sec);
+        uut.srtt = 0.875 * uut.srtt + 0.125 * sample_sec;
+    }
+
+    uut.rto = std::clamp(uut.srtt + std::max(0.001, 4 * uut.rttvar), RTO_MIN_MS / 1000.0, RTO_MAX_MS / 1000.0);
+}
+
+/**
+ * @brief Signals the receiver thread to exit and joins it.
+ *
+ */
+void HardwareTester::stopReceiver()
+{
+    if (receiver.joinable())
+    {
+        stopping = true;
+        wakeReceiver();
+        receiver.join();
+    }
+    if (wakeFd != -1)
+    {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+}
+
+/**
+ * @brief Interrupts the receiver's poll so it re-reads deadlines and flags.
+ *
+ */
+void HardwareTester::wakeReceiver()
+{
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0) perror("write");
+}
+
+/**
+ * @brief Maps a peripheral code to its reply slot.
+ *
+ * @param peripheral Single peripheral code (TEST_UART, TEST_SPI or TEST_I2C).
+ * @return int Slot index, or -1 for an unknown code.
+ */
+int HardwareTester::slotOf(uint8_t peripheral)
+{
+    switch (peripheral)
+    {
+        case TEST_UART: return 0;
+        case TEST_SPI:  return 1;
+        case TEST_I2C:  return 2;
+        default:        return -1;
+    }
+}
 
+/**
+ * @brief Retrieves the next available test ID from the logger.
+ *
+ * @param id Reference to store the result.
+ * @return true if the operation succeeded.
+ * @return false if an exception occurred.
+ */
+bool HardwareTester::getNextTestId(uint32_t &id)
+{
     try
     {
         id = logger->getNextId();
@@ -263,15 +1684,3 @@ void HardwareTester::formatTimestamp(char *buffer, size_t size, const timeval &t
     struct tm *tm_info = localtime(&tv.tv_sec);
     strftime(buffer, size, "%Y-%m-%d %H:%M:%S", tm_info);
 }
-
-/**
- * @brief Computes the time elapsed in seconds between two timestamps.
- *
- * @param start Start time.
- * @param end End time.
- * @return double Elapsed time in seconds (with microsecond precision).
- */
-double HardwareTester::elapsedSeconds(const timeval &start, const timeval &end)
-{
-    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
-}
@@ -1,56 +1,359 @@
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <netinet/in.h>
 #include <sys/socket.h>
-#include <semaphore>
+#include <unordered_map>
 #include <vector>
+#include "LatencyHistogram.hpp"
+#include "Pattern.hpp"
 #include "TestLogger.hpp"
+#include "wire.h"
 
 #define TEST_UART 2                // UART test code
 #define TEST_SPI 4                 // SPI test code
 #define TEST_I2C 8                 // I2C test code
+#define TEST_ALL (TEST_UART | TEST_SPI | TEST_I2C)
+#define N_TESTS 3                  // Total number of test types
 
 #define N_ITERATIONS 1             // Default number of test iterations
+#define OUT_MSG_BUFSIZE WIRE_OUT_MSG_MAX_SIZE    // Max possible size of a serialized OutMsg
+#define OUT_MSG_HDR_SIZE WIRE_OUT_MSG_HDR_SIZE    // test_id, peripheral, n_iter, p_len
+#define OUT_MSG_MAX_PAYLOAD WIRE_MAX_PAYLOAD      // p_len is a single byte
+
+#define RTO_INITIAL_MS 3000        // Reply deadline before any RTT sample
+#define RTO_MIN_MS 200             // Lower bound of the adaptive deadline
+#define RTO_MAX_MS 60000           // Upper bound, also after backoff
+#define MAX_RETRANSMITS 3          // Resends of an OutMsg before giving up
+
+#define SOCK_RCVBUF_BYTES (4 * 1024 * 1024)  // Room for reply bursts from many UUTs
+#define SEND_BATCH 64              // Max OutMsgs handed to one sendmmsg call
+#define RECV_BATCH 64              // Max datagrams drained by one recvmmsg call
 
 class HardwareTester
 {
 public:
+    struct InMsg
+    {
+        uint32_t test_id;              /** Unique test ID */
+        uint8_t peripheral;            /** Peripheral code */
+        uint8_t test_result;           /** Test result (success/fail) */
+        uint32_t bridge_us;            /** Time spent past the bridge, 0 unless it replied in version 2 */
+    };
+
+    /**
+     * @brief Outcome of one test request
+     * 
+     */
+    struct TestResult
+    {
+        uint32_t test_id;              /** Unique test ID */
+        int uut;                       /** Index of the UUT in connect()'s list */
+        uint8_t flags;                 /** Peripherals tested */
+        uint8_t n_iter;                /** Iterations requested */
+        InMsg replies[N_TESTS];        /** Replies in UART, SPI, I2C order */
+        int n_replies;                 /** Number of valid entries in replies */
+        bool success;                  /** All peripherals succeeded */
+        bool timed_out;                /** Some replies never arrived */
+        int retransmits;               /** Number of times the OutMsg was resent */
+        struct timeval start;          /** Time the request was sent */
+        double duration_sec;           /** Time until the last reply */
+        double latency_sec;            /** Same, but from the intended send time (open loop) */
+    };
+
+    using CompletionHandler = std::function<void(const TestResult&)>;
+
+    /**
+     * @brief Where a streamed test stands, see runStreaming()
+     * 
+     */
+    struct Progress
+    {
+        uint32_t test_id;              /** ID the whole run is logged under */
+        int uut;                       /** Index of the UUT in connect()'s list */
+        unsigned iterations;           /** Iterations finished so far */
+        unsigned n_iter;               /** Iterations requested */
+        uint8_t failed;                /** Peripherals that failed in any chunk so far */
+        bool aborted;                  /** Stopped early at a failure */
+    };
+
+    using ProgressHandler = std::function<void(const Progress&)>;
+
+    /**
+     * @brief A piece of a pattern that some peripheral failed, see runPattern()
+     * 
+     */
+    struct PatternSegment
+    {
+        size_t offset;                 /** First byte of the segment in the pattern */
+        size_t length;                 /** Segment length, at most OUT_MSG_MAX_PAYLOAD */
+        uint32_t test_id;              /** Test that carried the segment */
+        uint8_t failed;                /** Peripherals that failed it or never replied */
+        uint32_t crc;                  /** CRC-32C of the bytes sent */
+    };
+
+    /**
+     * @brief Outcome of sending a whole pattern
+     * 
+     */
+    struct PatternResult
+    {
+        size_t size;                   /** Pattern length */
+        uint32_t crc;                  /** CRC-32C of the whole pattern */
+        size_t segments;               /** Tests the pattern was split into */
+        size_t completed;              /** Tests that were sent and completed */
+        std::vector<PatternSegment> failures;  /** Failed segments, in pattern order */
+        double duration_sec;           /** Time from the first send to the last reply */
+    };
+
+    /**
+     * @brief Time the bridge spent in each of its tasks since boot
+     * 
+     */
+    struct BridgeTiming
+    {
+        struct Task
+        {
+            uint32_t count;            /** Packets (or UART events) handled */
+            uint32_t max_us;           /** Longest single handling time */
+            uint64_t busy_us;          /** Total handling time */
+        };
+
+        Task ntou;                     /** UDP receive and hand-off to UART */
+        Task utx;                      /** UART writes */
+        Task uton;                     /** UART read, framing and UDP send */
+        uint64_t uptime_us;            /** Bridge uptime */
+    };
+
+    /**
+     * @brief Bridge counters, drops, queue depths and stack use, see wire_stats_t
+     * 
+     */
+    using BridgeStats = wire_stats_t;
+
+    /**
+     * @brief A test request, serialized once and reusable for any number of tests
+     * 
+     * Holds the OutMsg header with everything but the test_id filled in, and
+     * a copy of the payload (truncated to OUT_MSG_MAX_PAYLOAD bytes). Tests
+     * sent from it only differ in the test_id, which is patched into a copy
+     * of the 7-byte header; the payload is sent straight from the Request.
+     */
+    class Request
+    {
+    public:
+        Request(uint8_t flags, uint8_t n_iter, std::string_view payload);
+
+        uint8_t flags() const { return static_cast<uint8_t>(header[4]); }
+        std::string_view payload() const { return std::string_view(body, p_len); }
+
+    private:
+        friend class HardwareTester;
+
+        char header[OUT_MSG_HDR_SIZE];     /** test_id (zero), peripheral, n_iter, p_len */
+        size_t p_len;                      /** Payload length */
+        char body[OUT_MSG_MAX_PAYLOAD];    /** Payload bytes */
+    };
+
+    /**
+     * @brief Awaitable returned by runTestAsync
+     * 
+     * The test is sent when the coroutine suspends, and the coroutine is
+     * resumed from processCompletions() once the test has completed. If the
+     * test can't be sent the coroutine continues at once with a result whose
+     * test_id is 0 and success is false.
+     */
+    class TestAwaiter
+    {
+    public:
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        TestResult await_resume() const noexcept { return result; }
+
+    private:
+        friend class HardwareTester;
+        TestAwaiter(HardwareTester& tester, int uut, uint8_t flags, uint8_t n_iter, std::string_view shared);
+
+        HardwareTester& tester;
+        int uut;
+        Request request;               /** Lives in the coroutine frame until resumed */
+        TestResult result;
+    };
+
     HardwareTester();
     ~HardwareTester();
 
     bool connect();
-    void runTests(uint8_t flags, uint8_t n_iter, std::string shared);
+    bool connect(const std::vector<std::string>& uut_addrs);
+    size_t uutCount() const;
+    const std::string& uutAddr(int uut) const;
+    void runTests(uint8_t flags, uint8_t n_iter, std::string_view shared);
+    void runTests(const Request& request);
+    void runPipelined(uint8_t flags, uint8_t n_iter, std::string_view shared,
+                      unsigned count, unsigned window, const CompletionHandler& on_complete = nullptr);
+    void runFleet(uint8_t flags, uint8_t n_iter, std::string_view shared,
+                  unsigned count, unsigned window, const CompletionHandler& on_complete = nullptr);
+    void runOpenLoop(uint8_t flags, uint8_t n_iter, std::string_view shared,
+                     double rate, unsigned count, const CompletionHandler& on_complete = nullptr);
+    TestResult runStreaming(int uut, uint8_t flags, uint8_t n_iter, std::string_view shared,
+                            uint8_t chunk, bool abort_on_fail, const ProgressHandler& on_progress = nullptr);
+    PatternResult runPattern(int uut, uint8_t flags, uint8_t n_iter, const Pattern& pattern, size_t size,
+                             unsigned window, const CompletionHandler& on_complete = nullptr);
     std::string strLast();
 
+    bool submitAsync(int uut, const Request& request, CompletionHandler on_complete);
+    TestAwaiter runTestAsync(int uut, uint8_t flags, uint8_t n_iter, std::string_view shared);
+    int completionFd() const;
+    size_t processCompletions(int timeout_ms = 0);
+    size_t asyncOutstanding() const;
+
+    bool queryBridgeTiming(int uut, BridgeTiming& timing, int timeout_ms = 1000);
+    bool stats(int uut, BridgeStats& out, int timeout_ms = 1000);
+    void printLatency(std::ostream& out);
+    void writeLatencyJson(std::ostream& out);
+
+    void startAsyncLogging(std::chrono::milliseconds flush_interval = std::chrono::milliseconds(100));
+
 private:
-    void sendOutMsg();
-    void recvInMsg(int idx);
-    bool getNextTestId(uint32_t& id);
-    void formatTimestamp(char* buffer, size_t size, const struct timeval& tv);
-    double elapsedSeconds(const struct timeval& start, const struct timeval& end);
+    /**
+     * @brief A UUT and the RTT estimate (RFC 6298) of its link
+     * 
+     */
+    struct Uut
+    {
+        std::string name;              /** Address as given to connect() */
+        sockaddr_in addr;              /** Resolved address of the bridge */
+        bool haveRtt = false;          /** srtt and rttvar hold a sample */
+        double srtt = 0;               /** Smoothed round trip, seconds */
+        double rttvar = 0;             /** Round trip variation, seconds */
+        double rto = RTO_INITIAL_MS / 1000.0;  /** Current reply deadline, seconds */
+        bool timingReady = false;      /** `timing` holds a reply to queryBridgeTiming() */
+        BridgeTiming timing;           /** Last timing reply */
+        bool statsReady = false;       /** `bridgeStats` holds a reply to stats() */
+        BridgeStats bridgeStats{};     /** Last stats reply */
+    };
 
-    int sock;
-    sockaddr sockAddr;
-    TestLogger* logger;
+    /**
+     * @brief A test waiting for its replies, one slot per peripheral
+     * 
+     */
+    struct PendingTest
+    {
+        int uut;                       /** Index into uuts */
+        uint8_t expected;              /** Peripheral flags awaited */
+        uint8_t received;              /** Peripheral flags received so far */
+        InMsg replies[N_TESTS];        /** Replies indexed by slotOf() */
+        struct timeval start;          /** Time the request was sent */
+        std::chrono::steady_clock::time_point intended;   /** Scheduled send time */
+        std::chrono::steady_clock::time_point first_sent; /** First transmission */
+        std::chrono::steady_clock::time_point sent_at;   /** Last (re)transmission */
+        std::chrono::steady_clock::time_point deadline;  /** Resend or give up at */
+        int retransmits;               /** Resends so far */
+        char header[OUT_MSG_HDR_SIZE]; /** OutMsg header with this test's ID */
+        const Request *request;        /** Payload source, valid until completion */
+        CompletionHandler on_complete; /** Set for tests of the async API */
+    };
+
+    using PendingMap = std::unordered_map<uint32_t, PendingTest>;
 
-    struct OutMsg
+    /**
+     * @brief OutMsgs collected for a single sendmmsg call
+     * 
+     * With the version 2 wire format, consecutive tests for the same UUT
+     * and Request share a datagram, up to WIRE_MAX_TESTS of them.
+     */
+    struct SendBatch
     {
-        uint32_t test_id;              /** Unique test ID */
-        uint8_t peripheral;            /** Peripheral code */
-        uint8_t n_iter;                /** Number of iterations */
-        uint8_t p_len;                 /** Payload length */
-        char payload[256];             /** Payload buffer */
+        struct mmsghdr msgs[SEND_BATCH];
+        struct iovec iov[SEND_BATCH][3];          /** Header, payload, then version 2 test entries */
+        char headers[SEND_BATCH][OUT_MSG_HDR_SIZE];
+        char tests[SEND_BATCH][WIRE_MAX_TESTS * WIRE_TEST_SIZE];
+        const Request *requests[SEND_BATCH];      /** Payload source of each datagram */
+        int uuts[SEND_BATCH];                     /** Destination of each datagram */
+        unsigned n = 0;                           /** Queued datagrams */
     };
 
-    struct InMsg
+    /**
+     * @brief Progress of runWindowed() on one UUT
+     * 
+     */
+    struct WindowState
     {
-        uint32_t test_id;              /** Unique test ID */
-        uint8_t peripheral;            /** Peripheral code */
-        uint8_t test_result;           /** Test result (success/fail) */
+        unsigned sent = 0;             /** Tests sent to this UUT */
+        unsigned outstanding = 0;      /** Of those, tests not completed yet */
+        bool failed = false;           /** A send failed; no more tests for this UUT */
     };
 
-    OutMsg outMsg;
-    std::vector<InMsg> inMsgs;
-    std::vector<int> results;
-    std::vector<std::thread> threads;
-    std::binary_semaphore doneSem{0};
+    void runWindowed(size_t n_uuts, const Request& request, unsigned count, unsigned window,
+                     const CompletionHandler& on_complete);
+    bool submitTest(int uut, const Request& request, uint32_t& test_id, SendBatch *batch = nullptr,
+                    CompletionHandler on_complete = nullptr,
+                    std::chrono::steady_clock::time_point intended = {});
+    TestResult waitCompleted(uint32_t test_id);
+    PendingTest& addPending(uint32_t test_id);
+    void removePending(PendingMap::iterator it);
+    void logResult(const TestResult& result);
+    void sendOutMsg(int uut, const char *header, const Request& request);
+    void queueOutMsg(SendBatch& batch, int uut, const char *header, const Request& request);
+    void flushOutMsgs(SendBatch& batch);
+    void recvLoop();
+    void dispatch(const char *buf, int len, const sockaddr_in& from);
+    void handleInMsg(const InMsg& msg, const sockaddr_in& from);
+    void handleTiming(const char *buf, int len, const sockaddr_in& from);
+    void handleStats(const char *buf, int len, const sockaddr_in& from);
+    bool sendControl(int uut, uint32_t tag);
+    void handleReply(const char *buf, int len, const sockaddr_in& from);
+    void complete(uint32_t test_id, bool timed_out = false);
+    int checkDeadlines();
+    void updateRto(Uut& uut, double sample_sec);
+    void stopReceiver();
+    void wakeReceiver();
+    static int slotOf(uint8_t peripheral);
+    bool getNextTestId(uint32_t& id);
+    void formatTimestamp(char* buffer, size_t size, const struct timeval& tv);
+
+    int sock;
+    std::vector<Uut> uuts;
+    TestLogger* logger;
+
+    std::atomic<uint32_t> lastTestId{0};
+
+    // Single receiver thread, demultiplexing replies from all UUTs into pending tests
+    std::thread receiver;
+    int wakeFd;
+    std::atomic<bool> stopping{false};
+    std::mutex pendingMutex;
+    std::condition_variable pendingCv;
+    PendingMap pending;
+    std::vector<PendingMap::node_type> spareNodes;   // Recycled so steady state doesn't allocate
+    std::vector<TestResult> completed;
+
+    // Scratch of runWindowed(), kept between runs so they don't allocate
+    std::vector<WindowState> windows;
+    std::vector<TestResult> windowBatch;
+
+    // Completed async tests, handed to the caller's loop through readyFd
+    int readyFd;
+    std::vector<std::pair<TestResult, CompletionHandler>> ready;
+    std::vector<std::pair<TestResult, CompletionHandler>> readyBatch;  // Owned by processCompletions()
+    std::atomic<size_t> nAsync{0};
+
+    // Earliest known deadline; RTT estimates in uuts are also guarded by pendingMutex
+    std::chrono::steady_clock::time_point pollUntil = std::chrono::steady_clock::time_point::max();
+
+    // Per-stage latency of every test, on the monotonic clock
+    LatencyHistogram idAllocLatency;     // getNextId()
+    LatencyHistogram sendLatency;        // Building and sending (or queueing) the OutMsg
+    LatencyHistogram firstReplyLatency;  // Last transmission to first reply
+    LatencyHistogram lastReplyLatency;   // Last transmission to last reply
+    LatencyHistogram bridgeLatency;      // Bridge to STM32 and back, from version 2 replies
+    LatencyHistogram logLatency;         // logTest() call
 };
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "LatencyHistogram.hpp"
+#include <bit>
+#include <cstdio>
+
+/**
+ * @brief Counts one sample
+ * 
+ * @param ns Sample in nanoseconds
+ */
+void LatencyHistogram::record(uint64_t ns)
+{
+    buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t prev = maximum.load(std::memory_order_relaxed);
+    while (ns > prev && !maximum.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief Counts one sample
+ * 
+ * @param d Sample as a steady_clock duration; negative values count as 0
+ */
+void LatencyHistogram::record(std::chrono::steady_clock::duration d)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+}
+
+/**
+ * @brief Number of samples recorded
+ * 
+ */
+uint64_t LatencyHistogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Largest sample recorded, in nanoseconds (exact)
+ * 
+ */
+uint64_t LatencyHistogram::max() const
+{
+    return maximum.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Mean of the samples in nanoseconds (exact), 0 if there are none
+ * 
+ */
+double LatencyHistogram::mean() const
+{
+    uint64_t n = count();
+    return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0;
+}
+
+/**
+ * @brief Value at or below which a fraction `q` of the samples fall
+ * 
+ * @param q Quantile in [0, 1], e.g. 0.99
+ * @return uint64_t Highest value of the bucket holding that sample, capped
+ *                  at max(); 0 if there are no samples
+ */
+uint64_t LatencyHistogram::percentile(double q) const
+{
+    uint64_t n = count();
+    if (n == 0) return 0;
+
+    uint64_t rank = static_cast<uint64_t>(q * n + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; ++b)
+    {
+        seen += buckets[b].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t v = highestIn(b);
+            return v < max() ? v : max();
+        }
+    }
+    return max();
+}
+
+/**
+ * @brief Print one line of percentiles in microseconds
+ * 
+ * @param out Stream to print to
+ * @param name Label of the line
+ */
+void LatencyHistogram::print(std::ostream& out, const char *name) const
+{
+    char line[192];
+    std::snprintf(line, sizeof(line),
+                  "%-12s n=%-8llu p50=%.1fus p90=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n",
+                  name, (unsigned long long)count(),
+                  percentile(0.50) / 1e3, percentile(0.90) / 1e3, percentile(0.99) / 1e3,
+                  percentile(0.999) / 1e3, max() / 1e3);
+    out << line;
+}
+
+/**
+ * @brief Write the summary as a JSON object, values in microseconds
+ * 
+ * @param out Stream to write to
+ */
+void LatencyHistogram::writeJson(std::ostream& out) const
+{
+    char obj[256];
+    std::snprintf(obj, sizeof(obj),
+                  "{\"count\": %llu, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+                  "\"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f}",
+                  (unsigned long long)count(), mean() / 1e3,
+                  percentile(0.50) / 1e3, percentile(0.90) / 1e3, percentile(0.99) / 1e3,
+                  percentile(0.999) / 1e3, max() / 1e3);
+    out << obj;
+}
+
+/**
+ * @brief Bucket index of a value
+ * 
+ * Values below HIST_SUB_COUNT have a bucket each. Above that, a value with
+ * its highest bit at position `msb` lands in octave `msb - HIST_SUB_BITS`,
+ * and the HIST_SUB_BITS bits below the highest one pick the sub-bucket.
+ */
+size_t LatencyHistogram::bucketOf(uint64_t ns)
+{
+    if (ns < HIST_SUB_COUNT) return ns;
+
+    unsigned shift = std::bit_width(ns) - 1 - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + ((ns >> shift) - HIST_SUB_COUNT);
+}
+
+/**
+ * @brief Largest value that maps to `bucket`
+ * 
+ */
+uint64_t LatencyHistogram::highestIn(size_t bucket)
+{
+    if (bucket < HIST_SUB_COUNT) return bucket;
+
+    unsigned shift = bucket / HIST_SUB_COUNT - 1;
+    uint64_t sub = bucket % HIST_SUB_COUNT;
+    return ((HIST_SUB_COUNT + sub) << shift) + ((uint64_t(1) << shift) - 1);
+}
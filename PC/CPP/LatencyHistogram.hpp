@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#define HIST_SUB_BITS 6                // 64 linear sub-buckets per power of two (~1.6% resolution)
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/**
+ * @brief Lock-free log-linear latency histogram, in the style of HdrHistogram
+ * 
+ * Values are nanoseconds. Each power of two is split into HIST_SUB_COUNT
+ * equal buckets, so any value is reported within ~1.6% of what was recorded.
+ * record() may be called from any number of threads concurrently; readers
+ * see a consistent-enough snapshot for reporting.
+ */
+class LatencyHistogram
+{
+public:
+    void record(uint64_t ns);
+    void record(std::chrono::steady_clock::duration d);
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    uint64_t percentile(double q) const;
+
+    void print(std::ostream& out, const char *name) const;
+    void writeJson(std::ostream& out) const;
+
+private:
+    static size_t bucketOf(uint64_t ns);
+    static uint64_t highestIn(size_t bucket);
+
+    std::array<std::atomic<uint64_t>, HIST_BUCKETS> buckets{};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maximum{0};
+};
@@ -0,0 +1,260 @@
+#include "Pattern.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+namespace
+{
+    const struct
+    {
+        const char *name;
+        PatternKind kind;
+    } kinds[] = {
+        {"prbs7", PatternKind::Prbs7},
+        {"prbs15", PatternKind::Prbs15},
+        {"prbs31", PatternKind::Prbs31},
+        {"walk1", PatternKind::WalkingOnes},
+        {"random", PatternKind::Random},
+    };
+
+    // Reflected CRC-32C (Castagnoli) table, for CPUs without a CRC instruction
+    const std::array<uint32_t, 256> crc_table = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (c & 1 ? 0x82F63B78u : 0);
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    uint32_t crc32cSoft(const uint8_t *p, size_t len, uint32_t crc)
+    {
+        while (len--) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+
+#if CRC32C_X86
+    // SSE4.2 CRC32 instruction, eight bytes per step
+    __attribute__((target("sse4.2")))
+    uint32_t crc32cHw(const uint8_t *p, size_t len, uint32_t crc)
+    {
+        uint64_t c = crc;
+        for (; len >= 8; p += 8, len -= 8)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            c = _mm_crc32_u64(c, v);
+        }
+        crc = static_cast<uint32_t>(c);
+        while (len--) crc = _mm_crc32_u8(crc, *p++);
+        return crc;
+    }
+
+    const bool have_crc_insn = __builtin_cpu_supports("sse4.2");
+#elif CRC32C_ARM
+    // ARMv8 CRC32C instructions, eight bytes per step
+    uint32_t crc32cHw(const uint8_t *p, size_t len, uint32_t crc)
+    {
+        for (; len >= 8; p += 8, len -= 8)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            crc = __crc32cd(crc, v);
+        }
+        while (len--) crc = __crc32cb(crc, *p++);
+        return crc;
+    }
+
+    const bool have_crc_insn = true;
+#endif
+}
+
+/**
+ * @brief Construct a new Pattern object
+ *
+ * @param kind Pattern to generate
+ * @param seed LFSR start state for PRBS (0 means all ones), or the seed of
+ *             the random generator; unused by walking ones
+ */
+Pattern::Pattern(PatternKind kind, uint64_t seed) : kind(kind), seed(seed)
+{}
+
+/**
+ * @brief Parse a pattern spec: a name, optionally followed by ":<seed>"
+ *
+ * Names are prbs7, prbs15, prbs31, walk1 and random.
+ *
+ * @param spec Spec as given on the command line, e.g. "random:42"
+ * @param pattern Set to the parsed pattern
+ * @return true if the spec is valid
+ */
+bool Pattern::parse(const std::string& spec, Pattern& pattern)
+{
+    size_t colon = spec.find(':');
+    std::string name = spec.substr(0, colon);
+    uint64_t seed = 0;
+
+    if (colon != std::string::npos)
+    {
+        std::string digits = spec.substr(colon + 1);
+        if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) return false;
+        try
+        {
+            seed = std::stoull(digits);
+        }
+        catch (const std::exception&)
+        {
+            return false;
+        }
+    }
+
+    for (const auto& k : kinds)
+    {
+        if (name == k.name)
+        {
+            pattern = Pattern(k.kind, seed);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief CRC-32C of a buffer, with the CPU's CRC instruction when it has one
+ *
+ * @param data Bytes to checksum
+ * @param len Number of bytes
+ * @param crc CRC of the preceding bytes, to checksum a buffer in pieces
+ * @return uint32_t CRC-32C, e.g. 0xE3069283 for "123456789"
+ */
+uint32_t Pattern::crc32c(const void *data, size_t len, uint32_t crc)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+#if CRC32C_X86 || CRC32C_ARM
+    if (have_crc_insn) return ~crc32cHw(p, len, crc);
+#endif
+    return ~crc32cSoft(p, len, crc);
+}
+
+/**
+ * @brief Generate the first `size` bytes of the pattern
+ *
+ * @param size Number of bytes
+ * @return std::string Pattern bytes
+ */
+std::string Pattern::generate(size_t size) const
+{
+    std::string out(size, '\0');
+    Stream(*this).read(out.data(), size);
+    return out;
+}
+
+/**
+ * @brief The spec this pattern was parsed from, in canonical form
+ *
+ */
+std::string Pattern::spec() const
+{
+    for (const auto& k : kinds)
+    {
+        if (k.kind == kind)
+        {
+            return seed ? std::string(k.name) + ":" + std::to_string(seed) : std::string(k.name);
+        }
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Construct a new Stream object, positioned at the pattern's first byte
+ *
+ * @param pattern Pattern to read
+ */
+Pattern::Stream::Stream(const Pattern& pattern) : kind(pattern.kind), rng(pattern.seed)
+{
+    switch (kind)
+    {
+        case PatternKind::Prbs7:
+            degree = 7;
+            tap = 6;
+            break;
+
+        case PatternKind::Prbs15:
+            degree = 15;
+            tap = 14;
+            break;
+
+        case PatternKind::Prbs31:
+            degree = 31;
+            tap = 28;
+            break;
+
+        default:
+            return;
+    }
+
+    const uint32_t mask = (1u << degree) - 1;
+    lfsr = static_cast<uint32_t>(pattern.seed) & mask;
+    if (lfsr == 0) lfsr = mask;
+}
+
+/**
+ * @brief Read the next `len` bytes of the pattern
+ *
+ * PRBS sequences run the LFSR x^degree + x^tap + 1, MSB first. When the
+ * tap is at least 8 bits down, the next 8 output bits only depend on bits
+ * already in the register, so a whole byte is produced per step.
+ *
+ * @param out Receives the bytes
+ * @param len Number of bytes
+ */
+void Pattern::Stream::read(char *out, size_t len)
+{
+    const uint32_t mask = (1u << degree) - 1;
+
+    for (size_t i = 0; i < len; ++i, ++position)
+    {
+        uint32_t byte = 0;
+        switch (kind)
+        {
+            case PatternKind::WalkingOnes:
+                byte = 1u << (position % 8);
+                break;
+
+            case PatternKind::Random:
+                if (position % 8 == 0)
+                {
+                    uint64_t v = rng();
+                    std::memcpy(word, &v, sizeof(word));
+                }
+                byte = static_cast<uint8_t>(word[position % 8]);
+                break;
+
+            default:
+                if (tap >= 8)
+                {
+                    byte = ((lfsr >> (degree - 8)) ^ (lfsr >> (tap - 8))) & 0xff;
+                    lfsr = ((lfsr << 8) | byte) & mask;
+                    break;
+                }
+                for (int k = 0; k < 8; ++k)
+                {
+                    uint32_t bit = ((lfsr >> (degree - 1)) ^ (lfsr >> (tap - 1))) & 1;
+                    lfsr = ((lfsr << 1) | bit) & mask;
+                    byte = (byte << 1) | bit;
+                }
+                break;
+        }
+        out[i] = static_cast<char>(byte);
+    }
+}
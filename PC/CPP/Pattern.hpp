@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+#define PATTERN_DEFAULT_SIZE 4096      // Bytes generated for --pattern without --size
+#define PATTERN_MAX_SIZE (16u << 20)   // Largest pattern accepted on the command line
+
+/**
+ * @brief Kinds of stress pattern Pattern can generate
+ *
+ */
+enum class PatternKind
+{
+    Prbs7,                             /** x^7 + x^6 + 1 */
+    Prbs15,                            /** x^15 + x^14 + 1 */
+    Prbs31,                            /** x^31 + x^28 + 1 */
+    WalkingOnes,                       /** 0x01, 0x02, ..., 0x80, repeated */
+    Random,                            /** Seeded pseudo random bytes */
+};
+
+/**
+ * @brief Test payload generator
+ *
+ * Generates deterministic byte patterns of any length, so a failing run
+ * can be reproduced from its spec (e.g. "prbs31" or "random:42") alone.
+ * PRBS sequences are the usual Fibonacci LFSRs, output MSB first and
+ * seeded with all ones unless a seed is given.
+ */
+class Pattern
+{
+public:
+    /**
+     * @brief Reads a pattern from its first byte on, in pieces of any size
+     * 
+     * Reading the pieces one after another gives the same bytes as
+     * generate() does in one go, without holding the whole pattern.
+     */
+    class Stream
+    {
+    public:
+        explicit Stream(const Pattern& pattern);
+
+        void read(char *out, size_t len);
+
+    private:
+        PatternKind kind;
+        unsigned degree = 0;               /** PRBS register length */
+        unsigned tap = 0;                  /** PRBS feedback tap */
+        uint32_t lfsr = 0;                 /** PRBS register */
+        uint64_t position = 0;             /** Bytes read so far */
+        std::mt19937_64 rng;               /** Random: source of 8 bytes at a time */
+        char word[8] = {};                 /** Random: last 8 bytes drawn */
+    };
+
+    explicit Pattern(PatternKind kind = PatternKind::Prbs31, uint64_t seed = 0);
+
+    static bool parse(const std::string& spec, Pattern& pattern);
+    static uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
+
+    std::string generate(size_t size) const;
+    std::string spec() const;
+
+private:
+    PatternKind kind;
+    uint64_t seed;
+};
@@ -1,8 +1,32 @@
 #include "TestLogger.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <filesystem>
+#include <limits>
+#include <memory>
 #include <sstream>
 
+namespace
+{
+    /**
+     * @brief Resets a cached statement and clears its bindings on scope exit
+     * 
+     */
+    struct StmtReset
+    {
+        sqlite3_stmt *stmt;
+        explicit StmtReset(sqlite3_stmt *s) : stmt(s) {}
+        ~StmtReset()
+        {
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+        }
+    };
+}
+
 /**
  * @brief Construct a new Test Logger:: Test Logger object
  * 
@@ -23,232 +47,1107 @@ TestLogger::TestLogger()
 /**
  * @brief Destroy the Test Logger:: Test Logger object
  * 
+ * Flushes any queued records, finalizes the cached statements and closes
+ * the connection.
  */
-TestLogger::~TestLogger() = default;
+TestLogger::~TestLogger()
+{
+    stopAsync();
+    close();
+}
 
 /**
  * @brief Prep database for operations
  * 
+ * Opens the connection, creates the schema and prepares the statements on
+ * first use. Later calls are no-ops, and the other methods call this
+ * implicitly, so calling it up front only surfaces errors early.
+ * 
  * @throw std::runtime_error
  */
 void TestLogger::prep()
 {
     std::lock_guard<std::mutex> lock(db_mutex);
-    sqlite3 *db = nullptr;
+    if (!db) open();
+}
 
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK)
-    {
-        throw std::runtime_error("prep: Cannot open DB");
-    }
+/**
+ * @brief Get a string representation of test results by ID
+ * 
+ * With the results cache enabled, tests committed recently by this
+ * process are answered without querying the database.
+ * 
+ * @param id Test ID
+ * @return std::string Test results in a string format
+ * @throw std::runtime_error
+ */
+std::string TestLogger::strById(uint32_t id)
+{
+    std::ostringstream data;
+    if (fromCache(data, id)) return data.str();
 
-    const char *sql =
-        "CREATE TABLE IF NOT EXISTS test_logs ("
-        "test_id INTEGER, "
-        "timestamp TEXT, "
-        "duration REAL, "
-        "result INTEGER);";
+    // A queued record is only cached once the writer has committed it
+    flush();
+    if (fromCache(data, id)) return data.str();
 
-    char *err_msg = nullptr;
-    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
+    std::lock_guard<std::mutex> lock(db_mutex);
+    if (!db) open();
+    StmtReset reset(select_id_stmt);
+
+    sqlite3_bind_int64(select_id_stmt, 1, id);
+
+    int rc = sqlite3_step(select_id_stmt);
+    if (rc == SQLITE_ROW)
     {
-        std::string error = err_msg ? err_msg : "unknown";
-        sqlite3_free(err_msg);
-        sqlite3_close(db);
-        throw std::runtime_error("prep: Create table error: " + error);
+        formatRecord(data, sqlite3_column_int64(select_id_stmt, 0),
+                     reinterpret_cast<const char *>(sqlite3_column_text(select_id_stmt, 1)),
+                     sqlite3_column_double(select_id_stmt, 2),
+                     sqlite3_column_int(select_id_stmt, 3));
+    }
+    else
+    {
+        data << "No test record found for this ID";
     }
 
-    sqlite3_close(db);
+    return data.str();
 }
 
 /**
- * @brief Get a string representation of test results by ID
+ * @brief Print the results of many tests, in test ID order
  * 
- * @param id Test ID
- * @return std::string Test results in a string format
+ * Ranges are sorted and merged, and single IDs deduplicated, then looked
+ * up with as few queries as possible (single IDs in one IN list, ranges
+ * as BETWEEN terms, at most SQL_MAX_PARAMS parameters per query) on the
+ * primary key. Rows are written to out as they are read. Single IDs are
+ * never folded into a range, so every one that doesn't exist is reported,
+ * even next to or inside a range; ranges only print what they contain.
+ * 
+ * @param out Output sink
+ * @param ids Test IDs and ranges to print
  * @throw std::runtime_error
  */
-std::string TestLogger::strById(uint32_t id)
+void TestLogger::printByIds(std::ostream& out, std::vector<IdRange> ids)
 {
+    std::sort(ids.begin(), ids.end(), [](const IdRange& a, const IdRange& b) {
+        return a.from != b.from ? a.from < b.from : a.to < b.to;
+    });
+
+    // Singles and ranges stay sorted by from, which streamIds() relies on
+    std::vector<IdRange> merged;
+    size_t last_range = SIZE_MAX;
+    for (const IdRange& r : ids)
+    {
+        if (r.from == r.to)
+        {
+            if (merged.empty() || merged.back().from != r.from || merged.back().to != r.to) merged.push_back(r);
+        }
+        else if (last_range != SIZE_MAX && r.from <= static_cast<uint64_t>(merged[last_range].to) + 1)
+        {
+            merged[last_range].to = std::max(merged[last_range].to, r.to);
+        }
+        else
+        {
+            last_range = merged.size();
+            merged.push_back(r);
+        }
+    }
+
+    flush();
     std::lock_guard<std::mutex> lock(db_mutex);
-    sqlite3 *db = nullptr;
-    sqlite3_stmt *stmt = nullptr;
+    if (!db) open();
 
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK)
+    std::vector<IdRange> chunk;
+    size_t params = 0;
+    for (const IdRange& r : merged)
     {
-        throw std::runtime_error("strById: Cannot open DB");
+        size_t cost = r.from == r.to ? 1 : 2;
+        if (params + cost > SQL_MAX_PARAMS)
+        {
+            streamIds(out, chunk);
+            chunk.clear();
+            params = 0;
+        }
+        chunk.push_back(r);
+        params += cost;
     }
+    if (!chunk.empty()) streamIds(out, chunk);
+}
 
-    const char *query = "SELECT test_id, timestamp, duration, result "
-                        "FROM test_logs WHERE test_id = ?;";
-    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
+/**
+ * @brief Run one printByIds() query for sorted, disjoint ranges
+ * 
+ * @attention db_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::streamIds(std::ostream& out, const std::vector<IdRange>& chunk)
+{
+    std::vector<uint32_t> singles;
+    std::string where;
+    for (const IdRange& r : chunk)
     {
-        sqlite3_close(db);
-        throw std::runtime_error("strById: Failed to prepare statement");
+        if (r.from == r.to)
+        {
+            singles.push_back(r.from);
+        }
+        else
+        {
+            where += where.empty() ? "" : " OR ";
+            where += "test_id BETWEEN ? AND ?";
+        }
+    }
+    if (!singles.empty())
+    {
+        where += where.empty() ? "" : " OR ";
+        where += "test_id IN (?";
+        for (size_t i = 1; i < singles.size(); ++i) where += ",?";
+        where += ")";
     }
 
-    sqlite3_bind_int(stmt, 1, id);
+    std::string query = "SELECT test_id, timestamp, duration, result FROM test_logs WHERE " + where +
+                        " ORDER BY test_id ASC;";
+    sqlite3_stmt *stmt = prepare(query.c_str(), "printByIds");
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> guard(stmt, sqlite3_finalize);
 
-    std::ostringstream data;
-    int rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW)
+    int idx = 1;
+    for (const IdRange& r : chunk)
     {
-        int id = sqlite3_column_int(stmt, 0);
-        const unsigned char *timestamp = sqlite3_column_text(stmt, 1);
-        double duration = sqlite3_column_double(stmt, 2);
-        int result = sqlite3_column_int(stmt, 3);
+        if (r.from == r.to) continue;
+        sqlite3_bind_int64(stmt, idx++, r.from);
+        sqlite3_bind_int64(stmt, idx++, r.to);
+    }
+    for (uint32_t id : singles) sqlite3_bind_int64(stmt, idx++, id);
 
-        data << "Test ID: " << id << "\n"
-             << "Start Time: " << timestamp << "\n"
-             << "Duration: " << duration << " seconds\n"
-             << "Result: " << (result? "Success" : "Failure");
+    // singles is sorted, so missing IDs are found while merging it with the rows
+    size_t next_single = 0;
+    auto report_missing = [&](int64_t below) {
+        for (; next_single < singles.size() && singles[next_single] < below; ++next_single)
+        {
+            out << "No test record found for test ID " << singles[next_single] << "\n";
+        }
+    };
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        int64_t id = sqlite3_column_int64(stmt, 0);
+        report_missing(id);
+        if (next_single < singles.size() && singles[next_single] == id) ++next_single;
+
+        formatRecord(out, id, reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1)),
+                     sqlite3_column_double(stmt, 2), sqlite3_column_int(stmt, 3));
+        out << "\n";
     }
-    else
+    report_missing(std::numeric_limits<int64_t>::max());
+
+    if (rc != SQLITE_DONE)
     {
-        data << "No test record found for this ID";
+        throw std::runtime_error("printByIds: Error while reading rows");
     }
+}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return data.str();
+/**
+ * @brief Write one record in the strById() format, without a trailing newline
+ * 
+ */
+void TestLogger::formatRecord(std::ostream& out, int64_t id, const char *timestamp, double duration_sec,
+                              bool result)
+{
+    out << "Test ID: " << id << "\n"
+        << "Start Time: " << (timestamp ? timestamp : "") << "\n"
+        << "Duration: " << duration_sec << " seconds\n"
+        << "Result: " << (result? "Success" : "Failure");
+}
+
+/**
+ * @brief Rollup bucket of a test duration
+ * 
+ * Log-linear over microseconds like LatencyHistogram, but with
+ * ROLLUP_SUB_COUNT buckets per power of two, so an hour of tests takes
+ * only a few dozen rollup rows.
+ */
+int64_t TestLogger::bucketOf(double duration_sec)
+{
+    uint64_t us = duration_sec > 0 ? static_cast<uint64_t>(duration_sec * 1e6 + 0.5) : 0;
+    if (us < ROLLUP_SUB_COUNT) return us;
+
+    unsigned shift = std::bit_width(us) - 1 - ROLLUP_SUB_BITS;
+    return (shift + 1) * ROLLUP_SUB_COUNT + ((us >> shift) - ROLLUP_SUB_COUNT);
+}
+
+/**
+ * @brief Largest duration, in seconds, that maps to `bucket`
+ * 
+ */
+double TestLogger::highestIn(int64_t bucket)
+{
+    if (bucket < ROLLUP_SUB_COUNT) return bucket / 1e6;
+
+    unsigned shift = bucket / ROLLUP_SUB_COUNT - 1;
+    uint64_t sub = bucket % ROLLUP_SUB_COUNT;
+    return (((ROLLUP_SUB_COUNT + sub) << shift) + ((uint64_t(1) << shift) - 1)) / 1e6;
+}
+
+/**
+ * @brief SQL function latency_bucket(duration), bucketOf() for the rollup statements
+ * 
+ */
+void TestLogger::latencyBucket(sqlite3_context *ctx, int, sqlite3_value **argv)
+{
+    sqlite3_result_int64(ctx, bucketOf(sqlite3_value_double(argv[0])));
 }
 
 /**
  * @brief Get a CSV-formatted string of the test data
  * 
+ * Buffers the whole export in memory; prefer exportTo() for large tables.
+ * 
  * @return std::string Test data
  * @throw std::runtime_error
  */
 std::string TestLogger::exportAll()
 {
+    std::ostringstream data;
+    exportTo(data);
+    return data.str();
+}
+
+/**
+ * @brief Stream test data matching a filter to out in a CSV format
+ * 
+ * Rows are written as they are read, so memory use does not depend on the
+ * number of rows and output starts right away. Range filters are
+ * inclusive and use the primary key and the timestamp/result indexes.
+ * 
+ * @param out Output sink
+ * @param filter Optional test ID, time and result filters
+ * @throw std::runtime_error
+ */
+void TestLogger::exportTo(std::ostream& out, const ExportFilter& filter)
+{
+    flush();
     std::lock_guard<std::mutex> lock(db_mutex);
-    sqlite3 *db = nullptr;
-    sqlite3_stmt *stmt = nullptr;
+    if (!db) open();
 
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK)
-    {
-        throw std::runtime_error("exportAll: Cannot open DB");
-    }
+    std::string query = "SELECT test_id, timestamp, duration, result FROM test_logs WHERE 1";
+    if (filter.id_from) query += " AND test_id >= ?";
+    if (filter.id_to) query += " AND test_id <= ?";
+    if (filter.time_from) query += " AND timestamp >= ?";
+    if (filter.time_to) query += " AND timestamp <= ?";
+    if (filter.result) query += " AND result = ?";
+    query += " ORDER BY test_id ASC;";
 
-    const char *query = "SELECT test_id, timestamp, duration, result "
-                        "FROM test_logs ORDER BY test_id ASC;";
-    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
-    {
-        sqlite3_close(db);
-        throw std::runtime_error("exportAll: Failed to prepare statement");
-    }
+    sqlite3_stmt *stmt = prepare(query.c_str(), "exportTo");
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> guard(stmt, sqlite3_finalize);
 
-    std::ostringstream data;
-    data << "test_id, timestamp, duration, result\n";
+    int idx = 1;
+    if (filter.id_from) sqlite3_bind_int64(stmt, idx++, *filter.id_from);
+    if (filter.id_to) sqlite3_bind_int64(stmt, idx++, *filter.id_to);
+    if (filter.time_from) sqlite3_bind_text(stmt, idx++, filter.time_from->c_str(), -1, SQLITE_STATIC);
+    if (filter.time_to) sqlite3_bind_text(stmt, idx++, filter.time_to->c_str(), -1, SQLITE_STATIC);
+    if (filter.result) sqlite3_bind_int(stmt, idx++, *filter.result);
+
+    out << "test_id, timestamp, duration, result\n";
 
     int rc;
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
     {
-        int id = sqlite3_column_int(stmt, 0);
+        int64_t id = sqlite3_column_int64(stmt, 0);
         const unsigned char *timestamp = sqlite3_column_text(stmt, 1);
         double duration = sqlite3_column_double(stmt, 2);
         int result = sqlite3_column_int(stmt, 3);
 
-        data << id << "," << timestamp << "," << duration << "," << result << "\n";
+        out << id << "," << timestamp << "," << duration << "," << result << "\n";
     }
 
     if (rc != SQLITE_DONE)
     {
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        throw std::runtime_error("exportAll: Error while reading rows");
+        throw std::runtime_error("exportTo: Error while reading rows");
     }
-
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return data.str();
 }
 
 /**
  * @brief Get next test ID
  * 
+ * IDs are handed out from a block reserved in the database, so this only
+ * touches SQLite when the block runs out. Blocks start at one ID and grow
+ * with use, so short runs leave no gaps, and concurrent processes never
+ * get the same ID.
+ * 
  * @return uint32_t Next test ID
  * @throw std::runtime_error
  */
 uint32_t TestLogger::getNextId()
 {
+    std::lock_guard<std::mutex> lock(id_mutex);
+    if (next_id == block_end) reserveIds();
+    return next_id++;
+}
+
+/**
+ * @brief Log results of a test
+ * 
+ * In async mode the record is queued and written later by the writer
+ * thread; errors are then reported on stderr instead of thrown.
+ * 
+ * The record's transaction also adds it to the hourly rollups.
+ * 
+ * @param test_id Unique test ID (use get_next_id() to get it beforehand)
+ * @param timestamp Timestamp string in ISO 8601 format
+ * @param duration_sec Test duration in seconds
+ * @param result Test result
+ * @param context Start time, UUT and request of the test, for stats()
+ * @throw std::runtime_error
+ */
+void TestLogger::logTest(uint32_t test_id, const char *timestamp, double duration_sec, bool result,
+                         const TestContext& context)
+{
+    LogRecord r;
+    r.test_id = test_id;
+    std::snprintf(r.timestamp, sizeof(r.timestamp), "%s", timestamp);
+    r.duration_sec = duration_sec;
+    r.result = result;
+    r.start_us = context.start_us;
+    std::snprintf(r.uut, sizeof(r.uut), "%s", context.uut ? context.uut : "");
+    r.peripheral = context.peripheral;
+    r.n_iter = context.n_iter;
+
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex);
+        if (async)
+        {
+            queue.push_back(r);
+            ++queued_count;
+            return;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    writeBatch(std::span(&r, 1), {});
+    commit_latency.record(std::chrono::steady_clock::now() - start);
+    cacheRecord(r);
+}
+
+/**
+ * @brief Log the progress of a test that runs in chunks
+ * 
+ * One row per chunk, keyed by the test's ID and the iterations finished so
+ * far. Queued like logTest() records in async mode.
+ * 
+ * @param test_id ID the whole test is logged under
+ * @param iterations Iterations finished, this chunk included
+ * @param failed Peripheral flags that failed in this chunk
+ * @param duration_sec Time the chunk took
+ * @throw std::runtime_error
+ */
+void TestLogger::logProgress(uint32_t test_id, unsigned iterations, uint8_t failed, double duration_sec)
+{
+    ProgressRecord r{test_id, iterations, failed, duration_sec};
+
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex);
+        if (async)
+        {
+            progress_queue.push_back(r);
+            ++queued_count;
+            return;
+        }
+    }
+
     std::lock_guard<std::mutex> lock(db_mutex);
-    sqlite3 *db = nullptr;
-    sqlite3_stmt *stmt = nullptr;
+    if (!db) open();
+    insertProgress(r);
+}
+
+/**
+ * @brief Pass rate and duration percentiles per board, from the rollups
+ * 
+ * Only reads the hourly rollup tables, so the cost depends on the number
+ * of boards and hours covered, not on the number of tests. Tests logged by
+ * other tools since the last write are rolled up first.
+ * 
+ * @param filter Optional board and time range, and whether to split by hour
+ * @return std::vector<BoardStats> One entry per board (and hour), ordered by board
+ * @throw std::runtime_error
+ */
+std::vector<BoardStats> TestLogger::stats(const StatsFilter& filter)
+{
+    flush();
+    writeBatch({}, {});
+
+    std::lock_guard<std::mutex> lock(db_mutex);
+    const char *group = filter.hourly ? "uut, hour" : "uut";
+    std::string where = " WHERE hour >= ? AND hour <= ?";
+    if (filter.uut) where += " AND uut = ?";
+
+    auto bind = [&](sqlite3_stmt *stmt) {
+        int64_t lowest = std::numeric_limits<int64_t>::min(), highest = std::numeric_limits<int64_t>::max();
+        sqlite3_bind_int64(stmt, 1, filter.from_us ? *filter.from_us / ROLLUP_PERIOD_US : lowest);
+        sqlite3_bind_int64(stmt, 2, filter.to_us ? *filter.to_us / ROLLUP_PERIOD_US : highest);
+        if (filter.uut) sqlite3_bind_text(stmt, 3, filter.uut->c_str(), -1, SQLITE_STATIC);
+    };
+
+    std::string query = std::string("SELECT uut, MIN(hour), SUM(tests), SUM(passed), SUM(duration_sum), "
+                                    "MAX(duration_max) FROM rollup_hourly") + where +
+                        " GROUP BY " + group + " ORDER BY " + group + ";";
+    sqlite3_stmt *stmt = prepare(query.c_str(), "stats");
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> guard(stmt, sqlite3_finalize);
+    bind(stmt);
+
+    std::vector<BoardStats> rows;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        BoardStats& b = rows.emplace_back();
+        b.uut = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+        b.hour_us = sqlite3_column_int64(stmt, 1) * ROLLUP_PERIOD_US;
+        b.tests = sqlite3_column_int64(stmt, 2);
+        b.passed = sqlite3_column_int64(stmt, 3);
+        b.mean_sec = b.tests ? sqlite3_column_double(stmt, 4) / b.tests : 0;
+        b.max_sec = sqlite3_column_double(stmt, 5);
+        b.p50_sec = b.p90_sec = b.p99_sec = 0;
+    }
+    if (rc != SQLITE_DONE)
+    {
+        throw std::runtime_error("stats: Error while reading rows");
+    }
+
+    // Buckets come in the same board (and hour) order as the rows above
+    query = std::string("SELECT uut, ") + (filter.hourly ? "hour" : "0") + ", bucket, SUM(count) "
+            "FROM rollup_latency" + where + " GROUP BY " + group + ", bucket ORDER BY " + group + ", bucket;";
+    sqlite3_stmt *buckets = prepare(query.c_str(), "stats");
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> buckets_guard(buckets, sqlite3_finalize);
+    bind(buckets);
+
+    size_t i = 0;
+    uint64_t seen = 0;
+    while ((rc = sqlite3_step(buckets)) == SQLITE_ROW)
+    {
+        std::string uut = reinterpret_cast<const char *>(sqlite3_column_text(buckets, 0));
+        int64_t hour_us = sqlite3_column_int64(buckets, 1) * ROLLUP_PERIOD_US;
+        while (i < rows.size() && (rows[i].uut != uut || (filter.hourly && rows[i].hour_us != hour_us)))
+        {
+            ++i;
+            seen = 0;
+        }
+        if (i == rows.size()) break;
+
+        BoardStats& b = rows[i];
+        uint64_t before = seen;
+        seen += sqlite3_column_int64(buckets, 3);
+        double upper = std::min(highestIn(sqlite3_column_int64(buckets, 2)), b.max_sec);
+        for (auto [q, value] : {std::pair{0.50, &b.p50_sec}, {0.90, &b.p90_sec}, {0.99, &b.p99_sec}})
+        {
+            uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * b.tests + 0.5));
+            if (before < rank && seen >= rank) *value = upper;
+        }
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        throw std::runtime_error("stats: Error while reading rows");
+    }
+
+    return rows;
+}
+
+/**
+ * @brief Switch to asynchronous logging
+ * 
+ * Starts a writer thread that commits queued records in a single
+ * transaction every flush_interval, or sooner when flush() is called.
+ * 
+ * @param flush_interval Maximum time a record waits in the queue
+ * @throw std::runtime_error
+ */
+void TestLogger::startAsync(std::chrono::milliseconds flush_interval)
+{
+    prep();
+
+    std::lock_guard<std::mutex> queue_lock(queue_mutex);
+    if (async) return;
+
+    this->flush_interval = flush_interval;
+    async = true;
+    stopping = false;
+    writer = std::thread(&TestLogger::writerLoop, this);
+}
+
+/**
+ * @brief Wait until every record queued so far is written to the database
+ * 
+ * Returns immediately when not in async mode.
+ */
+void TestLogger::flush()
+{
+    std::unique_lock<std::mutex> queue_lock(queue_mutex);
+    if (!async) return;
 
+    uint64_t target = queued_count;
+    flush_requested = true;
+    queue_cv.notify_one();
+    flushed_cv.wait(queue_lock, [&] { return written_count >= target; });
+}
+
+/**
+ * @brief Time spent committing records to the database
+ * 
+ * One sample per synchronous logTest() insert, or per batch committed by
+ * the writer thread in async mode.
+ */
+const LatencyHistogram& TestLogger::commitLatency() const
+{
+    return commit_latency;
+}
+
+/**
+ * @brief Open the database, create the schema and prepare all statements
+ * 
+ * @attention db_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::open()
+{
     if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK)
     {
-        throw std::runtime_error("getNextId: Cannot open DB");
+        close();
+        throw std::runtime_error("prep: Cannot open DB");
     }
 
-    const char* query = "SELECT MAX(test_id) FROM test_logs;";
-    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    const char *sql =
+        "CREATE TABLE IF NOT EXISTS test_logs ("
+        "test_id INTEGER PRIMARY KEY, "
+        "timestamp TEXT, "
+        "duration REAL, "
+        "result INTEGER, "
+        "epoch_us INTEGER, "
+        "uut TEXT, "
+        "peripheral INTEGER, "
+        "n_iter INTEGER, "
+        "rolled_up INTEGER);"
+        "CREATE TABLE IF NOT EXISTS rollup_hourly ("
+        "uut TEXT NOT NULL, "
+        "hour INTEGER NOT NULL, "
+        "tests INTEGER NOT NULL, "
+        "passed INTEGER NOT NULL, "
+        "duration_sum REAL NOT NULL, "
+        "duration_max REAL NOT NULL, "
+        "PRIMARY KEY (uut, hour)) WITHOUT ROWID;"
+        "CREATE TABLE IF NOT EXISTS rollup_latency ("
+        "uut TEXT NOT NULL, "
+        "hour INTEGER NOT NULL, "
+        "bucket INTEGER NOT NULL, "
+        "count INTEGER NOT NULL, "
+        "PRIMARY KEY (uut, hour, bucket)) WITHOUT ROWID;"
+        "CREATE TABLE IF NOT EXISTS id_alloc ("
+        "id INTEGER PRIMARY KEY CHECK (id = 0), "
+        "next_id INTEGER NOT NULL);"
+        "CREATE TABLE IF NOT EXISTS test_progress ("
+        "test_id INTEGER NOT NULL, "
+        "iterations INTEGER NOT NULL, "
+        "failed INTEGER NOT NULL, "
+        "duration REAL, "
+        "PRIMARY KEY (test_id, iterations));";
+
+    char *err_msg = nullptr;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
     {
-        sqlite3_close(db);
-        throw std::runtime_error("getNextId: Failed to prepare statement");
+        std::string error = err_msg ? err_msg : "unknown";
+        sqlite3_free(err_msg);
+        close();
+        throw std::runtime_error("prep: Create table error: " + error);
     }
 
-    int rc = sqlite3_step(stmt);
-    uint32_t next_id = 1;
-    if (rc == SQLITE_ROW)
+    sqlite3_busy_timeout(db, DB_BUSY_TIMEOUT_MS);
+
+    // Only used by this connection's rollup statements, never in the schema,
+    // so other tools can keep writing to the database
+    if (sqlite3_create_function(db, "latency_bucket", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                latencyBucket, nullptr, nullptr) != SQLITE_OK)
+    {
+        close();
+        throw std::runtime_error("prep: Cannot register latency_bucket");
+    }
+
+    try
+    {
+        migrate();
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+
+    // Indexes go on the migrated table. Rows not yet in the rollups are
+    // found through the partial index, which stays as small as one batch;
+    // the rollup statements name it, as the planner would pick the
+    // epoch index and scan every row instead.
+    const char *index_sql =
+        "CREATE INDEX IF NOT EXISTS test_logs_timestamp ON test_logs (timestamp);"
+        "CREATE INDEX IF NOT EXISTS test_logs_result ON test_logs (result);"
+        "CREATE INDEX IF NOT EXISTS test_logs_epoch ON test_logs (epoch_us);"
+        "CREATE INDEX IF NOT EXISTS test_logs_uut_epoch ON test_logs (uut, epoch_us);"
+        "CREATE INDEX IF NOT EXISTS test_logs_pending ON test_logs (test_id) WHERE rolled_up IS NULL;";
+
+    if (sqlite3_exec(db, index_sql, 0, 0, &err_msg) != SQLITE_OK)
+    {
+        std::string error = err_msg ? err_msg : "unknown";
+        sqlite3_free(err_msg);
+        close();
+        throw std::runtime_error("prep: Create index error: " + error);
+    }
+
+    // WAL lets readers run while a batch is committed, and with
+    // synchronous=NORMAL a commit no longer waits for an fsync.
+    if (sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", 0, 0, &err_msg) != SQLITE_OK)
+    {
+        std::string error = err_msg ? err_msg : "unknown";
+        sqlite3_free(err_msg);
+        close();
+        throw std::runtime_error("prep: Journal mode error: " + error);
+    }
+
+    try
+    {
+        insert_stmt = prepare("INSERT INTO test_logs (test_id, timestamp, duration, result, "
+                              "epoch_us, uut, peripheral, n_iter) "
+                              "VALUES (?, ?, ?, ?, ?, ?, ?, ?);", "logTest");
+        select_id_stmt = prepare("SELECT test_id, timestamp, duration, result "
+                                 "FROM test_logs WHERE test_id = ?;", "strById");
+        next_id_stmt = prepare("SELECT MAX(IFNULL((SELECT next_id FROM id_alloc), 1), "
+                               "IFNULL((SELECT MAX(test_id) FROM test_logs), 0) + 1);", "getNextId");
+        reserve_stmt = prepare("INSERT OR REPLACE INTO id_alloc (id, next_id) VALUES (0, ?);", "getNextId");
+        progress_stmt = prepare("INSERT OR REPLACE INTO test_progress (test_id, iterations, failed, duration) "
+                                "VALUES (?, ?, ?, ?);", "logProgress");
+
+        // Rows written without an epoch time (by other tools) get it from
+        // their local time stamp; rows whose stamp doesn't parse are skipped
+        const std::string period = std::to_string(ROLLUP_PERIOD_US);
+        rollup_epoch_stmt = prepare("UPDATE test_logs INDEXED BY test_logs_pending SET epoch_us = "
+                                    "CAST(strftime('%s', timestamp, 'utc') AS INTEGER) * 1000000 "
+                                    "WHERE rolled_up IS NULL AND epoch_us IS NULL;", "rollup");
+        rollup_hourly_stmt = prepare(("INSERT INTO rollup_hourly "
+                                      "(uut, hour, tests, passed, duration_sum, duration_max) "
+                                      "SELECT IFNULL(uut, ''), epoch_us / " + period + ", COUNT(*), "
+                                      "SUM(IFNULL(result, 0) != 0), TOTAL(duration), MAX(IFNULL(duration, 0)) "
+                                      "FROM test_logs INDEXED BY test_logs_pending "
+                                      "WHERE rolled_up IS NULL AND epoch_us IS NOT NULL "
+                                      "GROUP BY 1, 2 "
+                                      "ON CONFLICT (uut, hour) DO UPDATE SET "
+                                      "tests = tests + excluded.tests, "
+                                      "passed = passed + excluded.passed, "
+                                      "duration_sum = duration_sum + excluded.duration_sum, "
+                                      "duration_max = MAX(duration_max, excluded.duration_max);").c_str(),
+                                     "rollup");
+        rollup_latency_stmt = prepare(("INSERT INTO rollup_latency (uut, hour, bucket, count) "
+                                       "SELECT IFNULL(uut, ''), epoch_us / " + period + ", "
+                                       "latency_bucket(duration), COUNT(*) "
+                                       "FROM test_logs INDEXED BY test_logs_pending "
+                                       "WHERE rolled_up IS NULL AND epoch_us IS NOT NULL "
+                                       "GROUP BY 1, 2, 3 "
+                                       "ON CONFLICT (uut, hour, bucket) DO UPDATE SET "
+                                       "count = count + excluded.count;").c_str(),
+                                      "rollup");
+        rollup_done_stmt = prepare("UPDATE test_logs INDEXED BY test_logs_pending SET rolled_up = 1 "
+                                   "WHERE rolled_up IS NULL;", "rollup");
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+/**
+ * @brief Bring an older test_logs table up to the current schema
+ * 
+ * Older databases have a plain test_id column, which makes MAX(test_id)
+ * and lookups by ID full table scans; the table is then rebuilt with a
+ * primary key, and duplicate IDs keep their first row. Columns added
+ * since are appended empty, and their rows are rolled up on the next write.
+ * 
+ * @attention db_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::migrate()
+{
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT pk FROM pragma_table_info('test_logs') WHERE name = 'test_id';",
+                           -1, &stmt, nullptr) != SQLITE_OK)
     {
-        if (sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+        throw std::runtime_error("prep: Failed to read schema");
+    }
+    bool has_pk = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) == 1;
+    sqlite3_finalize(stmt);
+
+    if (!has_pk) addPrimaryKey();
+
+    static const char *const columns[][2] = {
+        {"epoch_us", "INTEGER"}, {"uut", "TEXT"}, {"peripheral", "INTEGER"}, {"n_iter", "INTEGER"},
+        {"rolled_up", "INTEGER"},
+    };
+
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info('test_logs') WHERE name = ?;",
+                           -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        throw std::runtime_error("prep: Failed to read schema");
+    }
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> guard(stmt, sqlite3_finalize);
+
+    for (const auto& [name, type] : columns)
+    {
+        StmtReset reset(stmt);
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) continue;
+
+        std::string sql = std::string("ALTER TABLE test_logs ADD COLUMN ") + name + " " + type + ";";
+        char *err_msg = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), 0, 0, &err_msg) != SQLITE_OK)
         {
-            next_id = static_cast<uint32_t>(sqlite3_column_int(stmt, 0) + 1);
+            std::string error = err_msg ? err_msg : "unknown";
+            sqlite3_free(err_msg);
+            throw std::runtime_error("prep: Migration error: " + error);
         }
     }
-    else
+}
+
+/**
+ * @brief Rebuild test_logs with test_id as its primary key
+ * 
+ * @attention db_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::addPrimaryKey()
+{
+    const char *sql =
+        "BEGIN IMMEDIATE;"
+        "CREATE TABLE test_logs_new ("
+        "test_id INTEGER PRIMARY KEY, "
+        "timestamp TEXT, "
+        "duration REAL, "
+        "result INTEGER);"
+        "INSERT OR IGNORE INTO test_logs_new "
+        "SELECT test_id, timestamp, duration, result FROM test_logs "
+        "WHERE test_id IS NOT NULL ORDER BY rowid;"
+        "DROP TABLE test_logs;"
+        "ALTER TABLE test_logs_new RENAME TO test_logs;"
+        "COMMIT;";
+
+    char *err_msg = nullptr;
+    if (sqlite3_exec(db, sql, 0, 0, &err_msg) != SQLITE_OK)
     {
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
+        std::string error = err_msg ? err_msg : "unknown";
+        sqlite3_free(err_msg);
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, nullptr);
+        throw std::runtime_error("prep: Migration error: " + error);
+    }
+}
+
+/**
+ * @brief Reserve the next block of test IDs in the database
+ * 
+ * The block starts after both the last reserved ID and the highest logged
+ * ID, so IDs taken by tools that do not reserve are skipped as well.
+ * 
+ * @attention id_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::reserveIds()
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    if (!db) open();
+
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", 0, 0, nullptr) != SQLITE_OK)
+    {
+        throw std::runtime_error("getNextId: Cannot begin transaction");
+    }
+
+    int64_t first = 0;
+    {
+        StmtReset reset(next_id_stmt);
+        if (sqlite3_step(next_id_stmt) == SQLITE_ROW)
+        {
+            first = sqlite3_column_int64(next_id_stmt, 0);
+        }
+    }
+
+    bool ok = first > 0;
+    if (ok)
+    {
+        StmtReset reset(reserve_stmt);
+        sqlite3_bind_int64(reserve_stmt, 1, first + id_block_size);
+        ok = sqlite3_step(reserve_stmt) == SQLITE_DONE;
+    }
+
+    if (!ok || sqlite3_exec(db, "COMMIT;", 0, 0, nullptr) != SQLITE_OK)
+    {
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, nullptr);
         throw std::runtime_error("getNextId: Step failed");
     }
 
-    sqlite3_finalize(stmt);
+    next_id = static_cast<uint32_t>(first);
+    block_end = static_cast<uint32_t>(first + id_block_size);
+    if (id_block_size < ID_BLOCK_MAX) id_block_size *= 2;
+}
+
+/**
+ * @brief Finalize all cached statements and close the connection
+ * 
+ */
+void TestLogger::close()
+{
+    for (sqlite3_stmt **stmt : {&insert_stmt, &select_id_stmt, &next_id_stmt, &reserve_stmt, &progress_stmt,
+                                &rollup_epoch_stmt, &rollup_hourly_stmt, &rollup_latency_stmt, &rollup_done_stmt})
+    {
+        sqlite3_finalize(*stmt);
+        *stmt = nullptr;
+    }
+
     sqlite3_close(db);
-    return next_id;
+    db = nullptr;
 }
 
 /**
- * @brief Log results of a test
+ * @brief Prepare a statement on the open connection
  * 
- * @param test_id Unique test ID (use get_next_id() to get it beforehand)
- * @param timestamp Timestamp string in ISO 8601 format
- * @param duration_sec Test duration in seconds
- * @param result Test result
+ * @param sql SQL text
+ * @param caller Name of the method using the statement, for error messages
+ * @return sqlite3_stmt* Prepared statement
  * @throw std::runtime_error
  */
-void TestLogger::logTest(uint32_t test_id, const char *timestamp, double duration_sec, bool result)
+sqlite3_stmt *TestLogger::prepare(const char *sql, const char *caller)
 {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    sqlite3 *db = nullptr;
     sqlite3_stmt *stmt = nullptr;
-
-    if (sqlite3_open(db_path.c_str(), &db) != SQLITE_OK)
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
     {
-        throw std::runtime_error("logTest: Cannot open DB");
+        throw std::runtime_error(std::string(caller) + ": Failed to prepare statement");
     }
+    return stmt;
+}
 
-    const char *query = "INSERT INTO test_logs (test_id, timestamp, duration, result) "
-                        "VALUES (?, ?, ?, ?);";
-    if (sqlite3_prepare_v2(db, query, -1, &stmt, nullptr) != SQLITE_OK)
+/**
+ * @brief Insert a single record with the cached INSERT statement
+ * 
+ * @attention db_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::insertRecord(const LogRecord& r)
+{
+    StmtReset reset(insert_stmt);
+
+    sqlite3_bind_int(insert_stmt, 1, r.test_id);
+    sqlite3_bind_text(insert_stmt, 2, r.timestamp, -1, SQLITE_STATIC);
+    sqlite3_bind_double(insert_stmt, 3, r.duration_sec);
+    sqlite3_bind_int(insert_stmt, 4, r.result);
+    // Unknown context stays NULL
+    if (r.start_us) sqlite3_bind_int64(insert_stmt, 5, r.start_us);
+    if (r.uut[0]) sqlite3_bind_text(insert_stmt, 6, r.uut, -1, SQLITE_STATIC);
+    if (r.peripheral)
     {
-        sqlite3_close(db);
-        throw std::runtime_error("logTest: Failed to prepare statement");
+        sqlite3_bind_int(insert_stmt, 7, r.peripheral);
+        sqlite3_bind_int(insert_stmt, 8, r.n_iter);
     }
 
-    sqlite3_bind_int(stmt, 1, test_id);
-    sqlite3_bind_text(stmt, 2, timestamp, -1, SQLITE_STATIC);
-    sqlite3_bind_double(stmt, 3, duration_sec);
-    sqlite3_bind_int(stmt, 4, result);
-
-    int rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(insert_stmt);
     if (rc != SQLITE_DONE)
     {
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
         throw std::runtime_error("logTest: Insert step error");
     }
+}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+/**
+ * @brief Insert a progress row with the cached statement
+ * 
+ * @attention db_mutex must be held by the caller
+ * @throw std::runtime_error
+ */
+void TestLogger::insertProgress(const ProgressRecord& r)
+{
+    StmtReset reset(progress_stmt);
+
+    sqlite3_bind_int64(progress_stmt, 1, r.test_id);
+    sqlite3_bind_int(progress_stmt, 2, r.iterations);
+    sqlite3_bind_int(progress_stmt, 3, r.failed);
+    sqlite3_bind_double(progress_stmt, 4, r.duration_sec);
+
+    if (sqlite3_step(progress_stmt) != SQLITE_DONE)
+    {
+        throw std::runtime_error("logProgress: Insert step error");
+    }
+}
+
+/**
+ * @brief Add every row not yet rolled up to the rollup tables
+ * 
+ * Works on the rows of the partial test_logs_pending index only, so a
+ * write pays for its own rows. Rows other tools wrote are caught up alike.
+ * 
+ * @attention db_mutex must be held by the caller, inside a transaction
+ * @throw std::runtime_error
+ */
+void TestLogger::rollupPending()
+{
+    for (sqlite3_stmt *stmt : {rollup_epoch_stmt, rollup_hourly_stmt, rollup_latency_stmt, rollup_done_stmt})
+    {
+        StmtReset reset(stmt);
+        if (sqlite3_step(stmt) != SQLITE_DONE)
+        {
+            throw std::runtime_error(std::string("rollup: ") + sqlite3_errmsg(db));
+        }
+    }
+}
+
+/**
+ * @brief Write a batch of queued records in one transaction
+ * 
+ * The same transaction adds the records to the rollups. An empty batch
+ * only rolls up rows other tools wrote.
+ * 
+ * @param batch Records to write
+ * @param progress Progress rows to write
+ * @throw std::runtime_error
+ */
+void TestLogger::writeBatch(std::span<const LogRecord> batch, std::span<const ProgressRecord> progress)
+{
+    std::lock_guard<std::mutex> lock(db_mutex);
+    if (!db) open();
+
+    if (sqlite3_exec(db, "BEGIN;", 0, 0, nullptr) != SQLITE_OK)
+    {
+        throw std::runtime_error("writeBatch: Cannot begin transaction");
+    }
+
+    try
+    {
+        for (const LogRecord& r : batch)
+        {
+            insertRecord(r);
+        }
+        for (const ProgressRecord& r : progress)
+        {
+            insertProgress(r);
+        }
+        rollupPending();
+    }
+    catch (...)
+    {
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, nullptr);
+        throw;
+    }
+
+    if (sqlite3_exec(db, "COMMIT;", 0, 0, nullptr) != SQLITE_OK)
+    {
+        sqlite3_exec(db, "ROLLBACK;", 0, 0, nullptr);
+        throw std::runtime_error("writeBatch: Commit failed");
+    }
+}
+
+/**
+ * @brief Writer thread body: commit the queue every flush interval
+ * 
+ * Drains the queue one last time before exiting on stop.
+ */
+void TestLogger::writerLoop()
+{
+    std::vector<LogRecord> batch;
+    std::vector<ProgressRecord> progress;
+    std::unique_lock<std::mutex> queue_lock(queue_mutex);
+
+    while (true)
+    {
+        queue_cv.wait_for(queue_lock, flush_interval, [&] { return stopping || flush_requested; });
+
+        batch.swap(queue);
+        progress.swap(progress_queue);
+        flush_requested = false;
+        bool exiting = stopping;
+        queue_lock.unlock();
+
+        size_t n_records = batch.size() + progress.size();
+        if (n_records > 0)
+        {
+            try
+            {
+                auto start = std::chrono::steady_clock::now();
+                writeBatch(batch, progress);
+                commit_latency.record(std::chrono::steady_clock::now() - start);
+                for (const LogRecord& r : batch) cacheRecord(r);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << e.what() << ": dropped " << n_records << " records\n";
+            }
+        }
+
+        queue_lock.lock();
+        written_count += n_records;
+        batch.clear();
+        progress.clear();
+        flushed_cv.notify_all();
+
+        if (exiting && queue.empty() && progress_queue.empty())
+        {
+            // Later records are written synchronously by logTest()
+            async = false;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Keep the last RESULT_CACHE_SIZE committed results in memory
+ * 
+ * The cache is direct mapped rather than LRU: a test evicts the one
+ * RESULT_CACHE_SIZE IDs before it, so with sequential IDs it holds the
+ * most recent results, and a lookup or insert is one slot, with no list
+ * to update and no allocation.
+ */
+void TestLogger::enableResultCache()
+{
+    std::lock_guard<std::mutex> cache_lock(cache_mutex);
+    if (cache.empty()) cache.resize(RESULT_CACHE_SIZE);
+}
+
+/**
+ * @brief Remember a committed result in its results cache slot, if enabled
+ * 
+ */
+void TestLogger::cacheRecord(const LogRecord& r)
+{
+    std::lock_guard<std::mutex> cache_lock(cache_mutex);
+    if (cache.empty()) return;
+    CacheEntry& e = cache[r.test_id % RESULT_CACHE_SIZE];
+    e.valid = true;
+    e.record = r;
+}
+
+/**
+ * @brief Format a result from the results cache
+ * 
+ * @param out Output sink
+ * @param id Test ID
+ * @return true if the result was cached
+ */
+bool TestLogger::fromCache(std::ostream& out, uint32_t id)
+{
+    std::lock_guard<std::mutex> cache_lock(cache_mutex);
+    if (cache.empty()) return false;
+    const CacheEntry& e = cache[id % RESULT_CACHE_SIZE];
+    if (!e.valid || e.record.test_id != id) return false;
+    formatRecord(out, id, e.record.timestamp, e.record.duration_sec, e.record.result);
+    return true;
+}
+
+/**
+ * @brief Flush the queue and stop the writer thread, if running
+ * 
+ */
+void TestLogger::stopAsync()
+{
+    {
+        std::lock_guard<std::mutex> queue_lock(queue_mutex);
+        if (!writer.joinable()) return;
+        stopping = true;
+    }
+    queue_cv.notify_one();
+    writer.join();
 }
\ No newline at end of file
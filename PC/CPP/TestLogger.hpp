@@ -1,8 +1,93 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <string>
 #include <sqlite3.h>
 #include <mutex>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <thread>
+#include <vector>
+#include "LatencyHistogram.hpp"
+
+#define DB_BUSY_TIMEOUT_MS 5000        // Wait for other processes holding the DB lock
+#define ID_BLOCK_MAX 1024              // Largest block of test IDs reserved at once
+#define TIMESTAMP_BUFSIZE 32           // Room for "YYYY-MM-DD HH:MM:SS" and then some
+#define RESULT_CACHE_SIZE 1024         // Recently logged results kept in memory (power of two)
+#define SQL_MAX_PARAMS 500             // Bound parameters per query, well below SQLite's limit
+#define UUT_NAME_BUFSIZE 64            // Room for a UUT address in a queued record
+#define ROLLUP_PERIOD_US 3600000000LL  // Rollup rows cover one hour each
+#define ROLLUP_SUB_BITS 4              // 16 duration buckets per power of two in rollups (~6% resolution)
+#define ROLLUP_SUB_COUNT (1 << ROLLUP_SUB_BITS)
+
+/**
+ * @brief Where and how a test ran, logged next to its result
+ * 
+ */
+struct TestContext
+{
+    int64_t start_us = 0;              /** Start time in microseconds since the epoch, 0 if unknown */
+    const char *uut = "";              /** UUT address */
+    uint8_t peripheral = 0;            /** Peripherals tested */
+    uint8_t n_iter = 0;                /** Iterations requested */
+};
+
+/**
+ * @brief Optional filters for TestLogger::exportTo(); ranges are inclusive
+ * 
+ */
+struct ExportFilter
+{
+    std::optional<uint32_t> id_from;
+    std::optional<uint32_t> id_to;
+    std::optional<std::string> time_from;  /** "YYYY-MM-DD HH:MM:SS" */
+    std::optional<std::string> time_to;    /** "YYYY-MM-DD HH:MM:SS" */
+    std::optional<bool> result;
+};
+
+/**
+ * @brief Optional filters for TestLogger::stats()
+ * 
+ * Times are microseconds since the epoch. They select whole rollup hours:
+ * the hour each bound falls in is included.
+ */
+struct StatsFilter
+{
+    std::optional<std::string> uut;
+    std::optional<int64_t> from_us;
+    std::optional<int64_t> to_us;
+    bool hourly = false;               /** One row per board and hour instead of per board */
+};
+
+/**
+ * @brief Aggregates of one board, or of one board in one hour
+ * 
+ */
+struct BoardStats
+{
+    std::string uut;                   /** UUT address, empty for tests logged without one */
+    int64_t hour_us;                   /** Start of the (first) hour covered */
+    uint64_t tests;                    /** Tests logged */
+    uint64_t passed;                   /** Tests that succeeded */
+    double mean_sec;                   /** Mean duration */
+    double max_sec;                    /** Longest duration */
+    double p50_sec;                    /** Duration percentiles, from the rollup buckets */
+    double p90_sec;
+    double p99_sec;
+};
+
+/**
+ * @brief Inclusive range of test IDs for TestLogger::printByIds(); a single
+ * ID has from == to
+ * 
+ */
+struct IdRange
+{
+    uint32_t from;
+    uint32_t to;
+};
 
 class TestLogger
 {
@@ -10,13 +95,114 @@ public:
     TestLogger();
     ~TestLogger();
 
+    TestLogger(const TestLogger&) = delete;
+    TestLogger& operator=(const TestLogger&) = delete;
+
     void prep();
     std::string strById(uint32_t id);
+    void printByIds(std::ostream& out, std::vector<IdRange> ids);
     std::string exportAll();
+    void exportTo(std::ostream& out, const ExportFilter& filter = {});
     uint32_t getNextId();
-    void logTest(uint32_t test_id, const char *timestamp, double duration_sec, bool result);
+    void logTest(uint32_t test_id, const char *timestamp, double duration_sec, bool result,
+                 const TestContext& context = {});
+    std::vector<BoardStats> stats(const StatsFilter& filter = {});
+    void logProgress(uint32_t test_id, unsigned iterations, uint8_t failed, double duration_sec);
+
+    void startAsync(std::chrono::milliseconds flush_interval = std::chrono::milliseconds(100));
+    void flush();
+    void enableResultCache();
+
+    const LatencyHistogram& commitLatency() const;
 
 private:
+    struct LogRecord
+    {
+        uint32_t test_id;
+        char timestamp[TIMESTAMP_BUFSIZE];  /** Fixed size, so queueing doesn't allocate */
+        double duration_sec;
+        bool result;
+        int64_t start_us;
+        char uut[UUT_NAME_BUFSIZE];
+        uint8_t peripheral;
+        uint8_t n_iter;
+    };
+
+    struct ProgressRecord
+    {
+        uint32_t test_id;
+        unsigned iterations;               /** Iterations finished, this chunk included */
+        uint8_t failed;                    /** Peripherals that failed in this chunk */
+        double duration_sec;               /** Time the chunk took */
+    };
+
+    // Slot of the results cache, which is indexed by test_id % RESULT_CACHE_SIZE
+    struct CacheEntry
+    {
+        bool valid = false;
+        LogRecord record;
+    };
+
+    void open();
+    void close();
+    void migrate();
+    void addPrimaryKey();
+    void reserveIds();
+    sqlite3_stmt *prepare(const char *sql, const char *caller);
+    void insertRecord(const LogRecord& r);
+    void insertProgress(const ProgressRecord& r);
+    void rollupPending();
+    void writeBatch(std::span<const LogRecord> batch, std::span<const ProgressRecord> progress);
+    void writerLoop();
+    void stopAsync();
+    void cacheRecord(const LogRecord& r);
+    bool fromCache(std::ostream& out, uint32_t id);
+    void streamIds(std::ostream& out, const std::vector<IdRange>& chunk);
+    static void formatRecord(std::ostream& out, int64_t id, const char *timestamp, double duration_sec,
+                             bool result);
+    static int64_t bucketOf(double duration_sec);
+    static double highestIn(int64_t bucket);
+    static void latencyBucket(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+
     std::string db_path;
     std::mutex db_mutex;
+
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *insert_stmt = nullptr;
+    sqlite3_stmt *select_id_stmt = nullptr;
+    sqlite3_stmt *next_id_stmt = nullptr;
+    sqlite3_stmt *reserve_stmt = nullptr;
+    sqlite3_stmt *progress_stmt = nullptr;
+    sqlite3_stmt *rollup_epoch_stmt = nullptr;
+    sqlite3_stmt *rollup_hourly_stmt = nullptr;
+    sqlite3_stmt *rollup_latency_stmt = nullptr;
+    sqlite3_stmt *rollup_done_stmt = nullptr;
+
+    // Test IDs [next_id, block_end) are reserved for this process
+    std::mutex id_mutex;
+    uint32_t next_id = 0;
+    uint32_t block_end = 0;
+    uint32_t id_block_size = 1;
+
+    // Async mode: logTest() queues records and writer commits them in batches
+    std::thread writer;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::condition_variable flushed_cv;
+    std::vector<LogRecord> queue;
+    std::vector<ProgressRecord> progress_queue;
+    std::chrono::milliseconds flush_interval{0};
+    uint64_t queued_count = 0;
+    uint64_t written_count = 0;
+    bool async = false;
+    bool stopping = false;
+    bool flush_requested = false;
+
+    // Time per synchronous insert, or per committed batch in async mode
+    LatencyHistogram commit_latency;
+
+    // Results committed by this process, so strById() on a recent test (as
+    // in HardwareTester::strLast()) needs no query; empty until enabled
+    std::mutex cache_mutex;
+    std::vector<CacheEntry> cache;
 };
\ No newline at end of file
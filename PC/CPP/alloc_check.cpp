@@ -0,0 +1,111 @@
+// alloc_check.cpp
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include "FakeUut.hpp"
+#include "HardwareTester.hpp"
+
+#define CHECK_TESTS 2000               // Tests per warm-up or measured round
+#define CHECK_WINDOW 32                // Tests in flight at once
+#define CHECK_PAYLOAD 32               // Payload bytes of every test
+
+#define NETWORK_ERROR 2                // UDP communication error
+
+namespace
+{
+    std::atomic<unsigned long> n_allocs{0};
+}
+
+// Every allocation of the process goes through these, counted
+void *operator new(std::size_t size)
+{
+    n_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+/**
+ * @brief Runs `round` twice, to warm up and then to count its allocations
+ *
+ * @param name Name printed with the count
+ * @param round Runs CHECK_TESTS tests
+ * @return true if the measured round didn't allocate
+ */
+template <typename Round>
+bool check(const char *name, Round round)
+{
+    round();
+    unsigned long before = n_allocs.load();
+    round();
+    unsigned long allocs = n_allocs.load() - before;
+
+    std::cout << name << ": " << allocs << " allocations in " << CHECK_TESTS << " tests\n";
+    return allocs == 0;
+}
+
+/**
+ * @brief Checks that HardwareTester doesn't allocate per test once warm
+ *
+ * Tests run against the fake UUT of mthw_bench and are logged synchronously,
+ * so the count doesn't depend on how the writer thread happens to batch
+ * them. SQLite uses malloc and isn't counted.
+ */
+int main()
+{
+    FakeUut fake(0);
+    if (!fake.start()) return NETWORK_ERROR;
+
+    HardwareTester tester;
+    if (!tester.connect({LOOPBACK_ADDR}))
+    {
+        std::cerr << "Network connection failed\n";
+        return NETWORK_ERROR;
+    }
+
+    HardwareTester::Request request(TEST_ALL, N_ITERATIONS, std::string(CHECK_PAYLOAD, 'x'));
+    bool ok = true;
+
+    ok &= check("runTests", [&] {
+        for (int i = 0; i < CHECK_TESTS; ++i) tester.runTests(request);
+    });
+
+    ok &= check("runPipelined", [&] {
+        tester.runPipelined(TEST_ALL, N_ITERATIONS, request.payload(), CHECK_TESTS, CHECK_WINDOW);
+    });
+
+    ok &= check("submitAsync", [&] {
+        unsigned sent = 0, in_flight = 0;
+        auto on_complete = [&in_flight](const HardwareTester::TestResult&) { --in_flight; };
+        while (sent < CHECK_TESTS || in_flight > 0)
+        {
+            while (sent < CHECK_TESTS && in_flight < CHECK_WINDOW)
+            {
+                if (!tester.submitAsync(0, request, on_complete))
+                {
+                    sent = CHECK_TESTS;
+                    break;
+                }
+                ++sent;
+                ++in_flight;
+            }
+            if (in_flight == 0) break;
+            tester.processCompletions(-1);
+        }
+    });
+
+    std::cout << (ok ? "OK" : "FAILED: allocations grow with the number of tests") << "\n";
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,234 @@
+// bench.cpp
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "FakeUut.hpp"
+#include "HardwareTester.hpp"
+#include "LatencyHistogram.hpp"
+
+#define ARGS_ERROR 1                   // Error parsing command line arguments
+#define NETWORK_ERROR 2                // UDP communication error
+
+#define DEFAULT_COUNT 20000            // Requests sent when neither -c nor -d is given
+#define DEFAULT_WINDOW 32              // Requests in flight at once
+
+void print_usage(const std::string& progName);
+
+/**
+ * @brief Tallies of a benchmark run, filled from completion handlers
+ *
+ */
+struct BenchStats
+{
+    unsigned long completed = 0;
+    unsigned long failed = 0;
+    unsigned long timed_out = 0;
+    unsigned long retransmits = 0;
+    unsigned long replies_expected = 0;
+    unsigned long replies_missing = 0;
+    LatencyHistogram latency;
+};
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> uut_addrs;
+    bool loopback = false, open_loop = false;
+    double drop = 0, rate = 0, duration = 0;
+    unsigned long count = 0, window = DEFAULT_WINDOW, p_len = 0;
+    uint8_t flags = TEST_ALL;
+    uint8_t n_iter = N_ITERATIONS;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help")
+        {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (arg == "--loopback")
+        {
+            loopback = true;
+            continue;
+        }
+        if (arg == "--open-loop")
+        {
+            open_loop = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Error: '" << arg << "' requires a value\n";
+            return ARGS_ERROR;
+        }
+
+        std::string val = argv[++i];
+        try
+        {
+            if (arg == "--uut") uut_addrs.push_back(val);
+            else if (arg == "-r") rate = std::stod(val);
+            else if (arg == "-c") count = std::stoul(val);
+            else if (arg == "-d") duration = std::stod(val);
+            else if (arg == "-w") window = std::stoul(val);
+            else if (arg == "-p") p_len = std::stoul(val);
+            else if (arg == "-n") n_iter = std::stoul(val);
+            else if (arg == "-f") flags = std::stoul(val, nullptr, 0);
+            else if (arg == "--drop") drop = std::stod(val);
+            else
+            {
+                std::cerr << "Error: Unknown option " << arg << "\n";
+                return ARGS_ERROR;
+            }
+        }
+        catch (const std::exception&)
+        {
+            std::cerr << "Error: Invalid value '" << val << "' for " << arg << "\n";
+            return ARGS_ERROR;
+        }
+    }
+
+    if (p_len > OUT_MSG_MAX_PAYLOAD || window == 0 || rate < 0 || drop < 0 || drop > 1)
+    {
+        std::cerr << "Error: need -p 0-" << OUT_MSG_MAX_PAYLOAD << ", -w > 0, -r >= 0 and --drop 0-1\n";
+        return ARGS_ERROR;
+    }
+    if (open_loop && rate == 0)
+    {
+        std::cerr << "Error: --open-loop needs a target rate (-r)\n";
+        return ARGS_ERROR;
+    }
+    if (count == 0 && duration == 0) count = DEFAULT_COUNT;
+    if (open_loop && count == 0) count = static_cast<unsigned long>(rate * duration);
+
+    FakeUut fake(drop);
+    if (loopback)
+    {
+        if (!fake.start()) return NETWORK_ERROR;
+        uut_addrs = {LOOPBACK_ADDR};
+    }
+
+    HardwareTester tester;
+    if (!(uut_addrs.empty() ? tester.connect() : tester.connect(uut_addrs)))
+    {
+        std::cerr << "Network connection failed\n";
+        return NETWORK_ERROR;
+    }
+    tester.startAsyncLogging();
+
+    HardwareTester::Request request(flags, n_iter, std::string(p_len, 'x'));
+    BenchStats stats;
+    unsigned long sent = 0, in_flight = 0;
+
+    auto on_complete = [&](const HardwareTester::TestResult& r) {
+        --in_flight;
+        ++stats.completed;
+        if (!r.success) ++stats.failed;
+        if (r.timed_out) ++stats.timed_out;
+        stats.retransmits += r.retransmits;
+        stats.replies_expected += r.n_replies;
+        for (int k = 0; k < r.n_replies; ++k)
+        {
+            if (r.replies[k].test_result == 0) ++stats.replies_missing;
+        }
+        stats.latency.record(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(r.latency_sec)));
+    };
+
+    using clock = std::chrono::steady_clock;
+    auto interval = rate > 0 ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1 / rate))
+                             : clock::duration::zero();
+    auto start = clock::now();
+    auto stop_at = duration > 0 ? start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration))
+                                : clock::time_point::max();
+    auto next_send = start;
+    auto send_end = start;
+    size_t next_uut = 0;
+
+    if (open_loop)
+    {
+        // The tester's sender thread keeps to the schedule by itself, so the
+        // window never delays a request and latency counts from the schedule
+        tester.runOpenLoop(flags, n_iter, std::string(p_len, 'x'), rate, count, on_complete);
+        sent = count;
+        send_end = start + interval * count;
+    }
+
+    while (!open_loop)
+    {
+        auto now = clock::now();
+        bool sending = (count == 0 || sent < count) && now < stop_at;
+
+        // Send everything that is due, as far as the window allows
+        while (sending && in_flight < window && next_send <= now)
+        {
+            if (!tester.submitAsync(next_uut, request, on_complete))
+            {
+                sending = false;
+                count = sent;
+                break;
+            }
+            ++in_flight;
+            ++sent;
+            next_send += interval;
+            next_uut = (next_uut + 1) % tester.uutCount();
+            sending = (count == 0 || sent < count) && now < stop_at;
+        }
+
+        if (sending) send_end = clock::now();
+        if (!sending && in_flight == 0) break;
+
+        int timeout_ms = -1;
+        if (sending && in_flight < window)
+        {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_send - clock::now()).count();
+            timeout_ms = wait > 0 ? static_cast<int>(wait) : 0;
+        }
+        tester.processCompletions(timeout_ms);
+    }
+
+    double secs = std::chrono::duration<double>(clock::now() - start).count();
+    double send_secs = std::chrono::duration<double>(send_end - start).count();
+
+    std::cout << "sent " << sent << " requests (" << p_len << " byte payload, ";
+    if (open_loop) std::cout << "open loop";
+    else std::cout << "window " << window;
+    std::cout << ") to " << tester.uutCount() << " UUT(s) in " << send_secs << " s, all done in "
+              << secs << " s\n";
+    std::cout << "throughput: " << (send_secs > 0 ? sent / send_secs : 0) << " req/s sent";
+    if (rate > 0) std::cout << " (target " << rate << ")";
+    std::cout << ", " << (secs > 0 ? stats.completed / secs : 0) << " req/s completed\n";
+    std::cout << "failed: " << stats.failed << ", timed out: " << stats.timed_out
+              << ", resent: " << (sent ? 100.0 * stats.retransmits / sent : 0) << "% of requests"
+              << ", replies lost: "
+              << (stats.replies_expected ? 100.0 * stats.replies_missing / stats.replies_expected : 0) << "%\n";
+    stats.latency.print(std::cout, "latency");
+    tester.printLatency(std::cout);
+
+    return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void print_usage(const std::string& progName)
+{
+    std::cout <<
+        "Usage: " << progName << " [OPTIONS]\n"
+        "Floods UUTs with test requests and reports throughput, loss and latency.\n"
+        "OPTIONS:\n"
+        "  --uut <addr>   UUT to load (may be repeated; default is the tester's UUT)\n"
+        "  --loopback     Answer requests with a built-in fake UUT on " LOOPBACK_ADDR "\n"
+        "  --drop <frac>  With --loopback, drop this fraction (0-1) of replies\n"
+        "  -r <req/s>     Target request rate (default 0: as fast as the window allows)\n"
+        "  --open-loop    Keep to the -r schedule however many requests are in flight\n"
+        "                 (ignores -w); latency counts from each request's scheduled\n"
+        "                 send time, so a stall shows up in every request it delays\n"
+        "  -c <int>       Number of requests (default " << DEFAULT_COUNT << " unless -d is given)\n"
+        "  -d <sec>       Stop sending after this many seconds\n"
+        "  -w <int>       Maximum requests in flight, over all UUTs (default " << DEFAULT_WINDOW << ")\n"
+        "  -p <int>       Payload length, 0-" << OUT_MSG_MAX_PAYLOAD << " (default 0)\n"
+        "  -n <int>       Test iterations per request (default " << N_ITERATIONS << ")\n"
+        "  -f <flags>     Peripheral flags, e.g. 0x0e for all (default)\n"
+        "  -h, --help     Show this help and exit\n";
+}
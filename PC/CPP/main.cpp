@@ -3,9 +3,19 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include "HardwareTester.hpp"
+#include "LatencyHistogram.hpp"
+#include "Pattern.hpp"
 #include "TestLogger.hpp"
 
 #define ARGS_ERROR 1                   // Error parsing command line arguments
@@ -13,6 +23,17 @@
 #define DB_ERROR 3                     // SQLite3 database error
 
 void print_usage(const std::string& progName);
+bool parse_ids(const std::string& arg, std::vector<IdRange>& ids);
+bool parse_number(const std::string& arg, unsigned long max, unsigned long& val);
+bool parse_id(const std::string& arg, uint32_t& id);
+void print_latency(HardwareTester& tester, bool json);
+void run_streaming(HardwareTester& tester, uint8_t flags, uint8_t n_iter, const std::string& shared,
+                   uint8_t chunk, bool abort_on_fail);
+void run_pattern(HardwareTester& tester, uint8_t flags, uint8_t n_iter, const Pattern& pattern,
+                 size_t size, unsigned window);
+bool print_bridge_stats(HardwareTester& tester);
+bool parse_time(const std::string& arg, int64_t& epoch_us);
+void print_stats(const std::vector<BoardStats>& rows, bool hourly);
 
 int main(int argc, char* argv[])
 {
@@ -33,35 +54,65 @@ int main(int argc, char* argv[])
             return ARGS_ERROR;
         }
 
+        std::vector<IdRange> ids;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (!parse_ids(argv[i], ids))
+            {
+                std::cerr << "Error: Invalid test ID or range '" << argv[i] << "'\n";
+                return ARGS_ERROR;
+            }
+        }
+
         try
         {
-            logger.prep();
+            logger.printByIds(std::cout, ids);
         }
         catch(const std::exception& e)
         {
             std::cerr << e.what() << '\n';
             return DB_ERROR;
         }
-
-        for (int i = 2; i < argc; ++i)
-        {
-            uint32_t id = std::stoul(argv[i]);
-            std::cout << logger.strById(id) << "\n";
-        }
         return 0;
 
     }
     else if (first_arg == "export")
     {
-        if (argc > 2)
+        ExportFilter filter;
+        for (int i = 2; i < argc; ++i)
         {
-            std::cerr << "Error: 'export' takes no arguments\n";
-            return ARGS_ERROR;
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: '" << arg << "' requires a value\n";
+                return ARGS_ERROR;
+            }
+            std::string val = argv[++i];
+
+            uint32_t id;
+            int64_t epoch_us;
+            if ((arg == "--from-id" || arg == "--to-id") && parse_id(val, id))
+            {
+                (arg == "--from-id" ? filter.id_from : filter.id_to) = id;
+            }
+            // Compared as strings with the logged timestamps, so only the exact form will do
+            else if ((arg == "--since" || arg == "--until") && val.size() == sizeof("YYYY-MM-DD HH:MM:SS") - 1 &&
+                     parse_time(val, epoch_us))
+            {
+                (arg == "--since" ? filter.time_from : filter.time_to) = val;
+            }
+            else if (arg == "--result" && (val == "pass" || val == "fail")) filter.result = (val == "pass");
+            else
+            {
+                std::cerr << "Error: Invalid or unknown export filter " << arg << " " << val << "\n";
+                return ARGS_ERROR;
+            }
         }
 
         try
         {
             logger.prep();
+            logger.exportTo(std::cout, filter);
         }
         catch(const std::exception& e)
         {
@@ -69,18 +120,95 @@ int main(int argc, char* argv[])
             return DB_ERROR;
         }
 
-        std::cout << logger.exportAll();
         return EXIT_SUCCESS;
 
     }
+    else if (first_arg == "stats")
+    {
+        StatsFilter filter;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--hourly")
+            {
+                filter.hourly = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                std::cerr << "Error: '" << arg << "' requires a value\n";
+                return ARGS_ERROR;
+            }
+            std::string val = argv[++i];
+
+            int64_t epoch_us;
+            if (arg == "--uut") filter.uut = val;
+            else if ((arg == "--since" || arg == "--until") && parse_time(val, epoch_us))
+            {
+                (arg == "--since" ? filter.from_us : filter.to_us) = epoch_us;
+            }
+            else
+            {
+                std::cerr << "Error: Unknown stats filter " << arg << " " << val << "\n";
+                return ARGS_ERROR;
+            }
+        }
+
+        try
+        {
+            print_stats(logger.stats(filter), filter.hourly);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+            return DB_ERROR;
+        }
+        return EXIT_SUCCESS;
+    }
+    else if (first_arg == "bridge")
+    {
+        std::vector<std::string> uut_addrs;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg != "--uut" || i + 1 >= argc)
+            {
+                std::cerr << "Error: 'bridge' only takes '--uut <addr>'\n";
+                return ARGS_ERROR;
+            }
+            std::stringstream list(argv[++i]);
+            std::string addr;
+            while (std::getline(list, addr, ','))
+            {
+                if (!addr.empty()) uut_addrs.push_back(addr);
+            }
+        }
+
+        HardwareTester tester;
+        if (!(uut_addrs.empty() ? tester.connect() : tester.connect(uut_addrs)))
+        {
+            std::cerr << "Network connection failed\n";
+            return NETWORK_ERROR;
+        }
+        return print_bridge_stats(tester) ? EXIT_SUCCESS : NETWORK_ERROR;
+    }
     else
     {
         // Parse options
         bool want_u = false, want_s = false, want_i = false;
         std::string msg_u, msg_s, msg_i;
         bool got_u = false, got_s = false, got_i = false;
-        bool used_all = false, used_n = false;
+        bool used_all = false, used_n = false, used_c = false, used_w = false;
         uint n_iter = N_ITERATIONS;
+        unsigned long count = 1, window = 1;
+        std::vector<std::string> uut_addrs;
+        bool latency = false, latency_json = false;
+        double rate = 0;
+        unsigned long stream_chunk = 0;
+        bool abort_on_fail = false;
+        std::string pattern_spec;
+        unsigned long pattern_size = PATTERN_DEFAULT_SIZE;
+        bool used_size = false;
 
         for (int i = 1; i < argc; ++i)
         {
@@ -121,6 +249,105 @@ int main(int argc, char* argv[])
                 }
                 used_n = true;
             }
+            else if (arg == "-c" || arg == "-w")
+            {
+                bool& used = (arg == "-c") ? used_c : used_w;
+                if (used || i + 1 >= argc || argv[i + 1][0] == '-')
+                {
+                    std::cerr << "Error: '" << arg << "' must be followed by a positive number\n";
+                    return ARGS_ERROR;
+                }
+                unsigned long val;
+                if (!parse_number(argv[++i], UINT_MAX, val) || val == 0)
+                {
+                    std::cerr << "Error: '" << arg << "' must be a positive number up to " << UINT_MAX << "\n";
+                    return ARGS_ERROR;
+                }
+                (arg == "-c" ? count : window) = val;
+                used = true;
+            }
+            else if (arg == "-r")
+            {
+                if (rate > 0 || i + 1 >= argc || argv[i + 1][0] == '-')
+                {
+                    std::cerr << "Error: '-r' must be followed by a rate in tests per second\n";
+                    return ARGS_ERROR;
+                }
+                std::string val = argv[++i];
+                size_t end = 0;
+                try
+                {
+                    rate = std::stod(val, &end);
+                }
+                catch (const std::exception&)
+                {
+                    end = 0;
+                }
+                if (end != val.size() || !std::isfinite(rate) || rate <= 0)
+                {
+                    std::cerr << "Error: '-r' must be a positive number of tests per second\n";
+                    return ARGS_ERROR;
+                }
+            }
+            else if (arg == "--stream")
+            {
+                if (stream_chunk > 0 || i + 1 >= argc || argv[i + 1][0] == '-')
+                {
+                    std::cerr << "Error: '--stream' must be followed by a chunk size (1-255)\n";
+                    return ARGS_ERROR;
+                }
+                if (!parse_number(argv[++i], 255, stream_chunk) || stream_chunk == 0)
+                {
+                    std::cerr << "Error: '--stream' chunk size must be in range 1-255\n";
+                    return ARGS_ERROR;
+                }
+            }
+            else if (arg == "--abort")
+            {
+                abort_on_fail = true;
+            }
+            else if (arg == "--pattern")
+            {
+                if (!pattern_spec.empty() || i + 1 >= argc || argv[i + 1][0] == '-')
+                {
+                    std::cerr << "Error: '--pattern' must be followed by a pattern (e.g. prbs31)\n";
+                    return ARGS_ERROR;
+                }
+                pattern_spec = argv[++i];
+            }
+            else if (arg == "--size")
+            {
+                if (used_size || i + 1 >= argc || argv[i + 1][0] == '-')
+                {
+                    std::cerr << "Error: '--size' must be followed by a number of bytes\n";
+                    return ARGS_ERROR;
+                }
+                if (!parse_number(argv[++i], PATTERN_MAX_SIZE, pattern_size))
+                {
+                    std::cerr << "Error: '--size' must be a number of bytes up to " << PATTERN_MAX_SIZE << "\n";
+                    return ARGS_ERROR;
+                }
+                used_size = true;
+            }
+            else if (arg == "--latency" || arg == "--latency-json")
+            {
+                latency = true;
+                latency_json = (arg == "--latency-json");
+            }
+            else if (arg == "--uut")
+            {
+                if (i + 1 >= argc || argv[i + 1][0] == '-')
+                {
+                    std::cerr << "Error: '--uut' must be followed by an address\n";
+                    return ARGS_ERROR;
+                }
+                std::stringstream list(argv[++i]);
+                std::string addr;
+                while (std::getline(list, addr, ','))
+                {
+                    if (!addr.empty()) uut_addrs.push_back(addr);
+                }
+            }
             else if (arg[0] == '-' && arg[1] != '\0')
             {
                 for (size_t j = 1; j < arg.size(); ++j)
@@ -167,13 +394,50 @@ int main(int argc, char* argv[])
             return ARGS_ERROR;
         }
 
+        if (stream_chunk > 0 && (used_c || used_w || rate > 0))
+        {
+            std::cerr << "Error: '--stream' runs one test per UUT and can't be combined with -c, -w or -r\n";
+            return ARGS_ERROR;
+        }
+        if (abort_on_fail && stream_chunk == 0)
+        {
+            std::cerr << "Error: '--abort' needs '--stream'\n";
+            return ARGS_ERROR;
+        }
+
+        Pattern pattern;
+        if (!pattern_spec.empty())
+        {
+            if (!Pattern::parse(pattern_spec, pattern))
+            {
+                std::cerr << "Error: Unknown pattern '" << pattern_spec
+                          << "' (prbs7, prbs15, prbs31, walk1 or random, optionally followed by :<seed>)\n";
+                return ARGS_ERROR;
+            }
+            if (used_c || rate > 0 || stream_chunk > 0)
+            {
+                std::cerr << "Error: '--pattern' can't be combined with -c, -r or --stream\n";
+                return ARGS_ERROR;
+            }
+            if (got_u || got_s || got_i)
+            {
+                std::cerr << "Error: '--pattern' replaces the test message\n";
+                return ARGS_ERROR;
+            }
+        }
+        else if (used_size)
+        {
+            std::cerr << "Error: '--size' needs '--pattern'\n";
+            return ARGS_ERROR;
+        }
+
         // Fill defaults
         if (want_u && !got_u) msg_u = "Hello UART";
         if (want_s && !got_s) msg_s = "Hello SPI";
         if (want_i && !got_i) msg_i = "Hello I2C";
 
         HardwareTester tester;
-        if (!tester.connect())
+        if (!(uut_addrs.empty() ? tester.connect() : tester.connect(uut_addrs)))
         {
             std::cerr << "Network connection failed\n";
             return NETWORK_ERROR;
@@ -191,13 +455,263 @@ int main(int argc, char* argv[])
         else if (want_s) shared = msg_s;
         else if (want_i) shared = msg_i;
 
-        tester.runTests(flags, n_iter, shared);
-        std::cout << tester.strLast() << "\n";
+        if (!pattern_spec.empty())
+        {
+            tester.startAsyncLogging();
+            run_pattern(tester, flags, n_iter, pattern, pattern_size, window);
+            if (latency) print_latency(tester, latency_json);
+            return EXIT_SUCCESS;
+        }
+
+        if (stream_chunk > 0)
+        {
+            tester.startAsyncLogging();
+            run_streaming(tester, flags, n_iter, shared, stream_chunk, abort_on_fail);
+            if (latency) print_latency(tester, latency_json);
+            return EXIT_SUCCESS;
+        }
+
+        if (count == 1 && tester.uutCount() == 1 && rate == 0)
+        {
+            tester.runTests(flags, n_iter, shared);
+            std::cout << tester.strLast() << "\n";
+            if (latency) print_latency(tester, latency_json);
+            return EXIT_SUCCESS;
+        }
+
+        unsigned long done = 0, failed = 0;
+        std::vector<unsigned long> uut_done(tester.uutCount(), 0), uut_failed(tester.uutCount(), 0);
+        LatencyHistogram open_loop_latency;
+        auto on_complete = [&](const HardwareTester::TestResult& r) {
+            ++done;
+            ++uut_done[r.uut];
+            if (!r.success)
+            {
+                ++failed;
+                ++uut_failed[r.uut];
+            }
+            open_loop_latency.record(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(r.latency_sec)));
+        };
+
+        tester.startAsyncLogging();
+        auto start = std::chrono::steady_clock::now();
+        if (rate > 0)
+        {
+            tester.runOpenLoop(flags, n_iter, shared, rate * tester.uutCount(), count * tester.uutCount(), on_complete);
+        }
+        else
+        {
+            tester.runFleet(flags, n_iter, shared, count, window, on_complete);
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (tester.uutCount() > 1)
+        {
+            for (size_t u = 0; u < tester.uutCount(); ++u)
+            {
+                std::cout << tester.uutAddr(u) << ": " << uut_done[u] << " tests, "
+                          << uut_failed[u] << " failed\n";
+            }
+        }
+        std::cout << done << " tests, " << failed << " failed, "
+                  << (secs > 0 ? done / secs : 0) << " tests/s\n";
+        if (rate > 0) open_loop_latency.print(std::cout, "latency");
+        if (latency) print_latency(tester, latency_json);
 
         return EXIT_SUCCESS;
     }
 }
 
+/**
+ * @brief Runs one streamed test on every UUT at once, printing progress after each chunk.
+ *
+ * With a single UUT the progress line is updated in place and the result
+ * is printed at the end like for a plain test; with several, each chunk
+ * gets a line of its own.
+ *
+ * @param tester Connected tester.
+ * @param flags Peripherals to test.
+ * @param n_iter Total number of iterations.
+ * @param shared Payload of every chunk.
+ * @param chunk Most iterations per request.
+ * @param abort_on_fail Stop a UUT's test at its first failing chunk.
+ */
+void run_streaming(HardwareTester& tester, uint8_t flags, uint8_t n_iter, const std::string& shared,
+                   uint8_t chunk, bool abort_on_fail)
+{
+    std::mutex print_mutex;
+    bool single = tester.uutCount() == 1;
+
+    auto on_progress = [&](const HardwareTester::Progress& p) {
+        std::lock_guard<std::mutex> lock(print_mutex);
+        std::cout << (single ? "\r" : tester.uutAddr(p.uut) + ": ")
+                  << "test " << p.test_id << ": " << p.iterations << "/" << p.n_iter << " iterations";
+        if (p.failed)
+        {
+            std::cout << ", failed:";
+            if (p.failed & TEST_UART) std::cout << " UART";
+            if (p.failed & TEST_SPI) std::cout << " SPI";
+            if (p.failed & TEST_I2C) std::cout << " I2C";
+        }
+        if (p.aborted) std::cout << ", aborted";
+        std::cout << (single ? "" : "\n") << std::flush;
+    };
+
+    std::vector<std::thread> runs;
+    for (size_t u = 0; u < tester.uutCount(); ++u)
+    {
+        runs.emplace_back([&, u] { tester.runStreaming(u, flags, n_iter, shared, chunk, abort_on_fail, on_progress); });
+    }
+    for (std::thread& t : runs) t.join();
+
+    if (single) std::cout << "\n" << tester.strLast() << "\n";
+}
+
+/**
+ * @brief Sends a generated pattern to every UUT in turn and reports the failed segments.
+ *
+ * @param tester Connected tester.
+ * @param flags Peripherals to test.
+ * @param n_iter Iterations of every segment.
+ * @param pattern Pattern to generate.
+ * @param size Pattern length in bytes.
+ * @param window Most segments in flight per UUT.
+ */
+void run_pattern(HardwareTester& tester, uint8_t flags, uint8_t n_iter, const Pattern& pattern,
+                 size_t size, unsigned window)
+{
+    for (size_t u = 0; u < tester.uutCount(); ++u)
+    {
+        HardwareTester::PatternResult r = tester.runPattern(u, flags, n_iter, pattern, size, window);
+
+        if (tester.uutCount() > 1) std::cout << tester.uutAddr(u) << ": ";
+        char crc[16];
+        std::snprintf(crc, sizeof(crc), "0x%08x", r.crc);
+        std::cout << "pattern " << pattern.spec() << ", " << r.size << " bytes, crc32c " << crc << ": "
+                  << r.segments << " segments, " << r.failures.size() << " failed";
+        if (r.completed < r.segments) std::cout << ", " << r.segments - r.completed << " not sent";
+        std::cout << ", " << (r.duration_sec > 0 ? r.size / r.duration_sec : 0) << " bytes/s\n";
+
+        for (const HardwareTester::PatternSegment& s : r.failures)
+        {
+            std::snprintf(crc, sizeof(crc), "0x%08x", s.crc);
+            std::cout << "  bytes " << s.offset << "-" << s.offset + s.length - 1
+                      << " (test " << s.test_id << ", crc32c " << crc << ") failed:";
+            if (s.failed & TEST_UART) std::cout << " UART";
+            if (s.failed & TEST_SPI) std::cout << " SPI";
+            if (s.failed & TEST_I2C) std::cout << " I2C";
+            std::cout << "\n";
+        }
+    }
+}
+
+/**
+ * @brief Prints the per-stage latency percentiles and each bridge's task timing.
+ *
+ * @param tester Tester that ran the tests.
+ * @param json Print the percentiles as one JSON object instead of a table.
+ */
+void print_latency(HardwareTester& tester, bool json)
+{
+    if (json)
+    {
+        tester.writeLatencyJson(std::cout);
+        return;
+    }
+
+    tester.printLatency(std::cout);
+
+    for (size_t u = 0; u < tester.uutCount(); ++u)
+    {
+        HardwareTester::BridgeTiming t;
+        if (!tester.queryBridgeTiming(u, t))
+        {
+            std::cout << tester.uutAddr(u) << ": no timing reply from bridge\n";
+            continue;
+        }
+
+        std::cout << tester.uutAddr(u) << ": up " << t.uptime_us / 1000000 << " s\n";
+        const std::pair<const char *, const HardwareTester::BridgeTiming::Task *> tasks[] = {
+            {"ntouart", &t.ntou}, {"uart_tx", &t.utx}, {"uartton", &t.uton}};
+        for (const auto& [name, task] : tasks)
+        {
+            std::cout << "  " << name << ": " << task->count << " handled, "
+                      << (task->count ? task->busy_us / task->count : 0) << " us avg, "
+                      << task->max_us << " us max, "
+                      << task->busy_us / 1000 << " ms busy\n";
+        }
+    }
+}
+
+/**
+ * @brief Prints every bridge's traffic, drop and error counters, queue depths and stack use.
+ *
+ * @param tester Connected tester.
+ * @return true if every bridge replied.
+ */
+bool print_bridge_stats(HardwareTester& tester)
+{
+    bool all = true;
+
+    for (size_t u = 0; u < tester.uutCount(); ++u)
+    {
+        HardwareTester::BridgeStats s;
+        if (!tester.stats(u, s))
+        {
+            std::cout << tester.uutAddr(u) << ": no stats reply from bridge\n";
+            all = false;
+            continue;
+        }
+
+        std::cout << tester.uutAddr(u) << ": up " << s.uptime_us / 1000000 << " s\n"
+                  << "  udp in: " << s.udp_rx_packets << " packets, " << s.udp_rx_bytes << " bytes\n"
+                  << "  udp out: " << s.udp_tx_packets << " packets, " << s.udp_tx_bytes << " bytes\n"
+                  << "  dropped: " << s.too_long << " too long, " << s.uart_overflows << " uart overflows, "
+                  << s.no_client << " without client, " << s.backlog_dropped << " from backlog\n"
+                  << "  errors: " << s.recv_errors << " recvfrom, " << s.send_errors << " sendto\n"
+                  << "  queued: " << s.tx_queue << " for uart, " << s.uart_queue << " uart events, "
+                  << s.backlog << " in backlog\n"
+                  << "  forwarding: " << s.fwd_count << " replies, "
+                  << (s.fwd_count ? s.fwd_total_us / s.fwd_count : 0) << " us avg, "
+                  << s.fwd_max_us << " us max\n"
+                  << "  stack free: ntouart " << s.stack_free[0] << ", uart_tx " << s.stack_free[1]
+                  << ", uartton " << s.stack_free[2] << " bytes\n";
+    }
+
+    return all;
+}
+
+/**
+ * @brief Prints the pass rate and duration percentiles of each board (and hour).
+ *
+ * @param rows Result of TestLogger::stats().
+ * @param hourly Rows are per hour; label each with its hour.
+ */
+void print_stats(const std::vector<BoardStats>& rows, bool hourly)
+{
+    if (rows.empty())
+    {
+        std::cout << "No tests logged in this range\n";
+        return;
+    }
+
+    for (const BoardStats& b : rows)
+    {
+        if (hourly)
+        {
+            char hour[TIMESTAMP_BUFSIZE];
+            time_t t = b.hour_us / 1000000;
+            strftime(hour, sizeof(hour), "%Y-%m-%d %H:00", localtime(&t));
+            std::cout << hour << " ";
+        }
+        std::cout << (b.uut.empty() ? "(unknown)" : b.uut) << ": " << b.tests << " tests, "
+                  << (b.tests ? 100.0 * b.passed / b.tests : 0) << "% passed, duration ms: mean "
+                  << b.mean_sec * 1000 << ", p50 " << b.p50_sec * 1000 << ", p90 " << b.p90_sec * 1000
+                  << ", p99 " << b.p99_sec * 1000 << ", max " << b.max_sec * 1000 << "\n";
+    }
+}
+
 void print_usage(const std::string& progName)
 {
     std::cout <<
@@ -205,6 +719,27 @@ void print_usage(const std::string& progName)
         "       " << progName << " [COMMAND]\n"
         "OPTIONS:\n"
         "  -n <int>       Optional: set number (0-255) of test iterations\n"
+        "  -c <int>       Optional: run the test <int> times and print a summary\n"
+        "  -w <int>       Optional: keep up to <int> tests in flight with -c (default 1)\n"
+        "  -r <rate>      Optional: instead of -w, send <rate> tests per second on a\n"
+        "                 fixed schedule (open loop) and report latency measured from\n"
+        "                 each test's scheduled send time\n"
+        "  --uut <addr>   Optional: test this UUT instead of the default one. May be\n"
+        "                 repeated or given a comma separated list; with several\n"
+        "                 UUTs, -c, -w and -r apply to each board and a summary is printed\n"
+        "  --latency      Optional: print per-stage latency percentiles and the\n"
+        "                 bridges' task timing after the run\n"
+        "  --latency-json Optional: print the latency percentiles as JSON instead\n"
+        "  --stream <int> Optional: run the -n iterations as requests of at most <int>\n"
+        "                 iterations each, printing progress as each one completes.\n"
+        "                 One test per UUT; not with -c, -w or -r\n"
+        "  --abort        Optional: with --stream, stop a test at its first failure\n"
+        "  --pattern <p>  Optional: instead of a message, send a generated pattern,\n"
+        "                 split into 255-byte segments of one test each and -w of them\n"
+        "                 in flight; failed byte ranges are listed. <p> is prbs7,\n"
+        "                 prbs15, prbs31, walk1 or random, optionally followed by\n"
+        "                 :<seed> (e.g. random:42). Not with -c, -r or --stream\n"
+        "  --size <int>   Optional: pattern length in bytes (default 4096)\n"
         "  -u [\"msg\"]   Run UART test (with optional message, default if none)\n"
         "  -s [\"msg\"]   Run SPI test (with optional message, default if none)\n"
         "  -i [\"msg\"]   Run I2C test (with optional message, default if none)\n"
@@ -217,6 +752,115 @@ void print_usage(const std::string& progName)
         "At least one of u, s, i (or --all) must be provided. No letter may appear twice.\n"
         "\n"
         "COMMANDS:\n"
-        "  get <id1> <id2> ...   Print test data by test ID\n"
-        "  export                Print all available tests data in a csv format\n";
-}
\ No newline at end of file
+        "  get <id1> <id2> ...   Print test data by test ID. Each argument may be an ID,\n"
+        "                        an inclusive range <from>-<to>, or a comma separated\n"
+        "                        list of those (e.g. get 7 10-20,31)\n"
+        "  export [FILTERS]      Print all available tests data in a csv format\n"
+        "  stats [FILTERS]       Print pass rate and duration percentiles per board,\n"
+        "                        from hourly rollups kept as tests are logged\n"
+        "  bridge [--uut <addr>] Print each bridge's packet, drop and error counters,\n"
+        "                        queue depths, forwarding latency and free stack\n"
+        "\n"
+        "EXPORT FILTERS (ranges are inclusive):\n"
+        "  --from-id <id>        Only tests with ID >= id\n"
+        "  --to-id <id>          Only tests with ID <= id\n"
+        "  --since \"YYYY-MM-DD HH:MM:SS\"   Only tests started at or after this time\n"
+        "  --until \"YYYY-MM-DD HH:MM:SS\"   Only tests started at or before this time\n"
+        "  --result pass|fail    Only successful or failed tests\n"
+        "\n"
+        "STATS FILTERS (times select whole hours):\n"
+        "  --uut <addr>          Only this board\n"
+        "  --since \"YYYY-MM-DD HH:MM:SS\"   Only hours at or after this time\n"
+        "  --until \"YYYY-MM-DD HH:MM:SS\"   Only hours at or before this time\n"
+        "  --hourly              One line per board and hour\n";
+}
+
+/**
+ * @brief Parses a local time in the "YYYY-MM-DD HH:MM:SS" format of the logs.
+ *
+ * @param arg Command line argument.
+ * @param epoch_us Set to the time in microseconds since the epoch.
+ * @return true if arg was valid.
+ */
+bool parse_time(const std::string& arg, int64_t& epoch_us)
+{
+    struct tm tm = {};
+    const char *end = strptime(arg.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
+    if (!end || *end) return false;
+
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == -1) return false;
+    epoch_us = static_cast<int64_t>(t) * 1000000;
+    return true;
+}
+
+/**
+ * @brief Parses a decimal number given to an option.
+ *
+ * @param arg Command line argument; only digits are accepted.
+ * @param max Largest valid value.
+ * @param val Set to the number.
+ * @return true if arg was valid and at most max.
+ */
+bool parse_number(const std::string& arg, unsigned long max, unsigned long& val)
+{
+    if (arg.empty() || arg.find_first_not_of("0123456789") != std::string::npos) return false;
+    try
+    {
+        val = std::stoul(arg);
+        return val <= max;
+    }
+    catch (const std::exception&)
+    {
+        return false;
+    }
+}
+
+/**
+ * @brief Parses a single test ID.
+ *
+ * @param arg Command line argument.
+ * @param id Set to the ID.
+ * @return true if arg was a number in the range of test IDs.
+ */
+bool parse_id(const std::string& arg, uint32_t& id)
+{
+    unsigned long val;
+    if (!parse_number(arg, UINT32_MAX, val)) return false;
+    id = static_cast<uint32_t>(val);
+    return true;
+}
+
+/**
+ * @brief Parses a `get` argument: an ID, a range "from-to", or a comma
+ * separated list of those.
+ *
+ * @param arg Command line argument.
+ * @param ids Parsed ranges are appended here.
+ * @return true if arg was valid.
+ */
+bool parse_ids(const std::string& arg, std::vector<IdRange>& ids)
+{
+    std::stringstream list(arg);
+    std::string item;
+    bool any = false;
+    while (std::getline(list, item, ','))
+    {
+        IdRange r;
+        size_t dash = item.find('-');
+        if (dash == std::string::npos)
+        {
+            if (!parse_id(item, r.from)) return false;
+            r.to = r.from;
+        }
+        else if (!parse_id(item.substr(0, dash), r.from) || !parse_id(item.substr(dash + 1), r.to) ||
+                 r.from > r.to)
+        {
+            return false;
+        }
+        ids.push_back(r);
+        any = true;
+    }
+    return any;
+}
@@ -3,19 +3,99 @@
 #define WIFI_SSID          "Set your own"
 #define WIFI_PASSWORD      "Set your own"
 
+/*
+ * The bridge reconnects forever: the first retry is immediate, later ones
+ * back off from WIFI_RETRY_MIN_MS, doubling up to WIFI_RETRY_MAX_MS. The
+ * AP's BSSID and channel are cached in NVS so that boot and reconnects can
+ * skip the full scan; after WIFI_FAST_CONNECT_TRIES failed attempts with
+ * the cached AP, the bridge scans all channels again.
+ */
+#define WIFI_POWER_SAVE         WIFI_PS_NONE    // Modem sleep adds up to a beacon interval of latency
+#define WIFI_RETRY_MIN_MS       100
+#define WIFI_RETRY_MAX_MS       5000
+#define WIFI_FAST_CONNECT_TRIES 2
+#define WIFI_NVS_NAMESPACE      "bridge"
+#define WIFI_NVS_AP_KEY         "wifi_ap"
+
 #define UART_PORT_NUM      UART_NUM_2
 #define UART_BAUD_RATE     115200
 #define UART_TX_PIN        17
 #define UART_RX_PIN        16
 #define UART_BUF_SIZE      1024
+#define UART_TX_BUF_SIZE   2048
+#define UART_QUEUE_SIZE    20
+#define UART_READ_CHUNK    256
 
 #define START_BYTE         0xAA
 #define END_BYTE           0x55
 
+/*
+ * UART -> UDP framing. RAW frames are START_BYTE <body> END_BYTE and the
+ * body must not contain END_BYTE. STUFFED frames escape START_BYTE,
+ * END_BYTE and ESC_BYTE inside the body as ESC_BYTE, (byte ^ ESC_XOR),
+ * so any binary body can be carried. The STM32 side must use the same mode.
+ */
+#define UART_FRAMING_RAW     0
+#define UART_FRAMING_STUFFED 1
+#define UART_FRAMING       UART_FRAMING_RAW
+
+#define ESC_BYTE           0x7D
+#define ESC_XOR            0x20
+
 #define UDP_SOURCE_IP       "192.168.1.71"
 #define UDP_PORT            54321
 #define UDP_BUFFER_SIZE     1024
+#define UDP_SLOT_COUNT      8
+
+/*
+ * UART -> UDP batching. When enabled, frames that complete within
+ * UDP_BATCH_WINDOW_US of the first one are packed into a single datagram,
+ * each prefixed with its length as a 16-bit little-endian value, up to
+ * UDP_BATCH_BUDGET bytes. Every datagram is then sent in this format, so
+ * the PC side must be built with BRIDGE_BATCHING enabled too.
+ */
+#define UDP_BATCHING        0
+#define UDP_BATCH_WINDOW_US 1500
+#define UDP_BATCH_BUDGET    1400
+
+/*
+ * Replies that come in from the UART while WiFi is down are kept, up to
+ * UDP_BACKLOG_COUNT datagrams (the oldest is dropped when full), and sent
+ * as soon as the bridge has an IP again.
+ */
+#define UDP_BACKLOG_COUNT   8
+
+/*
+ * The UDP wire format, including the reserved TIMING_TEST_ID and
+ * STATS_TEST_ID and the batched version 2 requests, is defined in wire.h,
+ * which the PC tools share. Version 2 requests register one session per
+ * test, so the table should hold at least a few requests' worth of
+ * WIRE_MAX_TESTS.
+ */
+#define SESSION_TABLE_SIZE  128     // Must be a power of two
+#define SESSION_PROBE       4
+#define SESSION_TTL_MS      30000
+
+/*
+ * Task cores, priorities and stack sizes are set in menuconfig, under
+ * "Wifi-for-STM32 bridge" -> "Task placement" (see src/Kconfig.projbuild).
+ */
+#ifdef CONFIG_FREERTOS_UNICORE
+#define TASK_CORE_UART      0
+#define TASK_CORE_NET       0
+#else
+#define TASK_CORE_UART      CONFIG_BRIDGE_UART_CORE
+#define TASK_CORE_NET       CONFIG_BRIDGE_NET_CORE
+#endif
+#define TASK_PRIORITY_NTOU  CONFIG_BRIDGE_NTOU_PRIORITY
+#define TASK_PRIORITY_UART  CONFIG_BRIDGE_UART_PRIORITY
+#define TASK_PRIORITY_UTX   CONFIG_BRIDGE_UTX_PRIORITY
+#define TASK_PRIORITY_STATS 1
+#define TASK_STACK_NTOU     CONFIG_BRIDGE_NTOU_STACK_SIZE
+#define TASK_STACK_UART     CONFIG_BRIDGE_UART_STACK_SIZE
+#define TASK_STACK_UTX      CONFIG_BRIDGE_UTX_STACK_SIZE
+#define TASK_STACK_STATS    4096
+
+#define STACK_REPORT_INTERVAL_MS (CONFIG_BRIDGE_STACK_REPORT_INTERVAL * 1000)
 
-#define TASK_STACK_SIZE     4096
-#define TASK_PRIORITY_NTOU  10
-#define TASK_PRIORITY_UART  9
+#define STATS_INTERVAL_MS   1000
@@ -0,0 +1,348 @@
+/**
+ * @file wire.h
+ * @brief UDP wire format between the PC tools and the bridge
+ *
+ * Shared by PC/C, PC/CPP and the bridge (src/main.c). Every multi-byte
+ * field is little-endian and goes through the helpers below byte by byte,
+ * so the layout depends neither on the host nor on struct packing.
+ *
+ * Version 1 is the STM32's own format, one test per datagram:
+ *   OutMsg: test_id (u32), peripheral, n_iter, p_len, p_len payload bytes
+ *   InMsg:  test_id (u32), peripheral, result
+ *
+ * Version 2 is only spoken between the PC and the bridge. A request carries
+ * any number of tests that share one payload:
+ *   WIRE_V2_ID (u32), version, n_tests, p_len, p_len payload bytes,
+ *   then n_tests x { test_id (u32), peripheral, n_iter }
+ * Each test entry is laid out like the first six bytes of its OutMsg. The
+ * bridge expands the request into version 1 OutMsgs for the STM32, so the
+ * firmware is unchanged, and answers with replies that may each hold the
+ * results of several tests:
+ *   WIRE_V2_ID (u32), version, n_results,
+ *   then n_results x { test_id (u32), peripheral, result, bridge_us (u32) }
+ * bridge_us is the time from the request reaching the bridge to the
+ * STM32's reply reaching it, i.e. the UART and STM32 part of the round trip.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define WIRE_VERSION 2                 // Version of the batched format below
+
+/*
+ * Reserved test_ids. A 4-byte datagram holding only TIMING_TEST_ID is
+ * answered by the bridge itself with the time each of its tasks has spent
+ * handling packets since boot (see send_timing() in src/main.c): the tag,
+ * then for ntouart_task, uart_tx_task and uartton_task in turn count (u32),
+ * max_us (u32) and busy_us (u64), then the uptime in microseconds (u64).
+ * WIRE_V2_ID opens every version 2 request and reply. A 4-byte datagram
+ * holding only STATS_TEST_ID is answered with the bridge's counters, laid
+ * out as written by wire_put_stats().
+ */
+#define TIMING_TEST_ID 0xFFFFFFFFu
+#define TIMING_REPLY_SIZE (4 + 3 * 16 + 8)
+#define WIRE_V2_ID 0xFFFFFFFEu
+#define STATS_TEST_ID 0xFFFFFFFDu
+#define STATS_REPLY_SIZE (4 + 8 + 10 * 4 + 3 * 2 + 16 + 3 * 4)
+
+#define WIRE_MAX_PAYLOAD 255           // p_len is a single byte
+#define WIRE_OUT_MSG_HDR_SIZE 7        // test_id, peripheral, n_iter, p_len
+#define WIRE_OUT_MSG_MAX_SIZE (WIRE_OUT_MSG_HDR_SIZE + WIRE_MAX_PAYLOAD)
+#define WIRE_IN_MSG_SIZE 6             // test_id, peripheral, result
+
+#define WIRE_REQ_HDR_SIZE 7            // WIRE_V2_ID, version, n_tests, p_len
+#define WIRE_TEST_SIZE 6               // test_id, peripheral, n_iter
+#define WIRE_MAX_TESTS 32              // Most tests a sender puts in one request
+#define WIRE_MAX_REQ_SIZE (WIRE_REQ_HDR_SIZE + WIRE_MAX_PAYLOAD + WIRE_MAX_TESTS * WIRE_TEST_SIZE)
+
+#define WIRE_REPLY_HDR_SIZE 6          // WIRE_V2_ID, version, n_results
+#define WIRE_RESULT_SIZE 10            // test_id, peripheral, result, bridge_us
+#define WIRE_MAX_RESULTS 32            // Most results a sender puts in one reply
+#define WIRE_MAX_REPLY_SIZE (WIRE_REPLY_HDR_SIZE + WIRE_MAX_RESULTS * WIRE_RESULT_SIZE)
+
+/**
+ * @brief One test of a request, or the reply for one of its peripherals
+ *
+ * @struct wire_test_t
+ */
+typedef struct wire_test_t
+{
+    uint32_t test_id;              /** Unique test ID */
+    uint8_t peripheral;            /** Peripheral code (a bitfield in requests) */
+    uint8_t value;                 /** n_iter in requests, the result in replies */
+    uint32_t bridge_us;            /** Bridge timing, version 2 replies only */
+}wire_test_t;
+
+/**
+ * @brief Snapshot of the bridge's counters, as sent for STATS_TEST_ID
+ *
+ * Counters run from boot and wrap around; queue depths and stack figures
+ * are taken when the reply is made.
+ *
+ * @struct wire_stats_t
+ */
+typedef struct wire_stats_t
+{
+    uint64_t uptime_us;            /** Bridge uptime */
+    uint32_t udp_rx_packets;       /** Datagrams received from the PCs */
+    uint32_t udp_rx_bytes;         /** Bytes in those datagrams */
+    uint32_t udp_tx_packets;       /** Datagrams sent to the PCs */
+    uint32_t udp_tx_bytes;         /** Bytes in those datagrams */
+    uint32_t too_long;             /** UART frames dropped for being too long */
+    uint32_t uart_overflows;       /** UART FIFO or ring buffer overflows */
+    uint32_t recv_errors;          /** Failed recvfrom calls */
+    uint32_t send_errors;          /** Failed sendto calls */
+    uint32_t no_client;            /** Replies dropped for want of a PC to send them to */
+    uint32_t backlog_dropped;      /** Replies pushed out of a full reconnect backlog */
+    uint16_t tx_queue;             /** Datagrams waiting to be written to the UART */
+    uint16_t uart_queue;           /** UART events waiting to be handled */
+    uint16_t backlog;              /** Replies held until WiFi is back */
+    uint32_t fwd_count;            /** Replies matched to a request */
+    uint32_t fwd_max_us;           /** Longest time from request to reply */
+    uint64_t fwd_total_us;         /** Total time from request to reply */
+    uint32_t stack_free[3];        /** Least free stack of ntouart, uart_tx and uartton_task, bytes */
+}wire_stats_t;
+
+static inline void wire_put_u16 (void *dst, uint16_t v)
+{
+    uint8_t *p = (uint8_t *)dst;
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static inline uint16_t wire_get_u16 (const void *src)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline void wire_put_u32 (void *dst, uint32_t v)
+{
+    uint8_t *p = (uint8_t *)dst;
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static inline uint32_t wire_get_u32 (const void *src)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void wire_put_u64 (void *dst, uint64_t v)
+{
+    wire_put_u32(dst, (uint32_t)v);
+    wire_put_u32((uint8_t *)dst + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint64_t wire_get_u64 (const void *src)
+{
+    return wire_get_u32(src) | ((uint64_t)wire_get_u32((const uint8_t *)src + 4) << 32);
+}
+
+/**
+ * @brief Serialize a version 1 OutMsg
+ *
+ * @param dst At least WIRE_OUT_MSG_HDR_SIZE + p_len bytes
+ * @return size_t Bytes written
+ */
+static inline size_t wire_put_out_msg (void *dst, uint32_t test_id, uint8_t peripheral, uint8_t n_iter,
+                                       const void *payload, uint8_t p_len)
+{
+    uint8_t *p = (uint8_t *)dst;
+    const uint8_t *src = (const uint8_t *)payload;
+    wire_put_u32(p, test_id);
+    p[4] = peripheral;
+    p[5] = n_iter;
+    p[6] = p_len;
+    for (size_t i = 0; i < p_len; ++i)
+    {
+        p[WIRE_OUT_MSG_HDR_SIZE + i] = src[i];
+    }
+    return WIRE_OUT_MSG_HDR_SIZE + p_len;
+}
+
+/**
+ * @brief Parse a version 1 InMsg of WIRE_IN_MSG_SIZE bytes
+ */
+static inline wire_test_t wire_get_in_msg (const void *src)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    wire_test_t t = {wire_get_u32(p), p[4], p[5], 0};
+    return t;
+}
+
+/**
+ * @brief Write the header of a version 2 request; the payload and then the
+ * n_tests test entries follow it
+ */
+static inline void wire_put_req_hdr (void *dst, uint8_t n_tests, uint8_t p_len)
+{
+    uint8_t *p = (uint8_t *)dst;
+    wire_put_u32(p, WIRE_V2_ID);
+    p[4] = WIRE_VERSION;
+    p[5] = n_tests;
+    p[6] = p_len;
+}
+
+/**
+ * @brief Check the header of a version 2 request against its length
+ *
+ * @param src Datagram starting with WIRE_V2_ID
+ * @param len Datagram length
+ * @return int Number of tests, or -1 if the request is malformed or of an
+ * unknown version
+ */
+static inline int wire_check_req (const void *src, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    if (len < WIRE_REQ_HDR_SIZE || wire_get_u32(p) != WIRE_V2_ID || p[4] != WIRE_VERSION ||
+        len != WIRE_REQ_HDR_SIZE + p[6] + (size_t)p[5] * WIRE_TEST_SIZE)
+    {
+        return -1;
+    }
+    return p[5];
+}
+
+/**
+ * @brief Payload of a request that passed wire_check_req()
+ */
+static inline const uint8_t *wire_get_req_payload (const void *src, uint8_t *p_len)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    *p_len = p[6];
+    return p + WIRE_REQ_HDR_SIZE;
+}
+
+/**
+ * @brief Test entry i of a request that passed wire_check_req()
+ */
+static inline wire_test_t wire_get_req_test (const void *src, int i)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    return wire_get_in_msg(p + WIRE_REQ_HDR_SIZE + p[6] + (size_t)i * WIRE_TEST_SIZE);
+}
+
+/**
+ * @brief Write the header of a version 2 reply with n_results results
+ */
+static inline void wire_put_reply_hdr (void *dst, uint8_t n_results)
+{
+    uint8_t *p = (uint8_t *)dst;
+    wire_put_u32(p, WIRE_V2_ID);
+    p[4] = WIRE_VERSION;
+    p[5] = n_results;
+}
+
+/**
+ * @brief Write result i of a version 2 reply
+ */
+static inline void wire_put_result (void *dst, int i, const wire_test_t *r)
+{
+    uint8_t *p = (uint8_t *)dst + WIRE_REPLY_HDR_SIZE + (size_t)i * WIRE_RESULT_SIZE;
+    wire_put_u32(p, r->test_id);
+    p[4] = r->peripheral;
+    p[5] = r->value;
+    wire_put_u32(p + 6, r->bridge_us);
+}
+
+/**
+ * @brief Check the header of a version 2 reply against its length
+ *
+ * @return int Number of results, or -1 if the reply is malformed or of an
+ * unknown version
+ */
+static inline int wire_check_reply (const void *src, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    if (len < WIRE_REPLY_HDR_SIZE || wire_get_u32(p) != WIRE_V2_ID || p[4] != WIRE_VERSION ||
+        len != WIRE_REPLY_HDR_SIZE + (size_t)p[5] * WIRE_RESULT_SIZE)
+    {
+        return -1;
+    }
+    return p[5];
+}
+
+/**
+ * @brief Result i of a reply that passed wire_check_reply()
+ */
+static inline wire_test_t wire_get_result (const void *src, int i)
+{
+    const uint8_t *p = (const uint8_t *)src + WIRE_REPLY_HDR_SIZE + (size_t)i * WIRE_RESULT_SIZE;
+    wire_test_t t = {wire_get_u32(p), p[4], p[5], wire_get_u32(p + 6)};
+    return t;
+}
+
+/**
+ * @brief Serialize a stats reply: STATS_TEST_ID, then the fields of
+ * wire_stats_t in order
+ *
+ * @param dst At least STATS_REPLY_SIZE bytes
+ */
+static inline void wire_put_stats (void *dst, const wire_stats_t *s)
+{
+    uint8_t *p = (uint8_t *)dst;
+    const uint32_t counters[] = {s->udp_rx_packets, s->udp_rx_bytes, s->udp_tx_packets, s->udp_tx_bytes,
+                                 s->too_long, s->uart_overflows, s->recv_errors, s->send_errors,
+                                 s->no_client, s->backlog_dropped};
+
+    wire_put_u32(p, STATS_TEST_ID);
+    wire_put_u64(p + 4, s->uptime_us);
+    p += 12;
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i, p += 4)
+    {
+        wire_put_u32(p, counters[i]);
+    }
+    wire_put_u16(p, s->tx_queue);
+    wire_put_u16(p + 2, s->uart_queue);
+    wire_put_u16(p + 4, s->backlog);
+    wire_put_u32(p + 6, s->fwd_count);
+    wire_put_u32(p + 10, s->fwd_max_us);
+    wire_put_u64(p + 14, s->fwd_total_us);
+    p += 22;
+    for (int i = 0; i < 3; ++i, p += 4)
+    {
+        wire_put_u32(p, s->stack_free[i]);
+    }
+}
+
+/**
+ * @brief Parse a stats reply
+ *
+ * @param src Datagram starting with STATS_TEST_ID
+ * @param len Datagram length
+ * @return int 0 on success, -1 if the reply doesn't have STATS_REPLY_SIZE bytes
+ */
+static inline int wire_get_stats (const void *src, size_t len, wire_stats_t *s)
+{
+    const uint8_t *p = (const uint8_t *)src;
+    uint32_t *counters[] = {&s->udp_rx_packets, &s->udp_rx_bytes, &s->udp_tx_packets, &s->udp_tx_bytes,
+                            &s->too_long, &s->uart_overflows, &s->recv_errors, &s->send_errors,
+                            &s->no_client, &s->backlog_dropped};
+
+    if (len != STATS_REPLY_SIZE || wire_get_u32(p) != STATS_TEST_ID)
+    {
+        return -1;
+    }
+
+    s->uptime_us = wire_get_u64(p + 4);
+    p += 12;
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i, p += 4)
+    {
+        *counters[i] = wire_get_u32(p);
+    }
+    s->tx_queue = wire_get_u16(p);
+    s->uart_queue = wire_get_u16(p + 2);
+    s->backlog = wire_get_u16(p + 4);
+    s->fwd_count = wire_get_u32(p + 6);
+    s->fwd_max_us = wire_get_u32(p + 10);
+    s->fwd_total_us = wire_get_u64(p + 14);
+    p += 22;
+    for (int i = 0; i < 3; ++i, p += 4)
+    {
+        s->stack_free[i] = wire_get_u32(p);
+    }
+    return 0;
+}
@@ -1,11 +1,15 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
+#include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_event.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "esp_system.h"
 #include "esp_netif.h"
 #include "esp_netif_ip_addr.h"
@@ -14,46 +18,332 @@
 #include "lwip/inet.h"
 
 #include "config.h"
-
-static EventGroupHandle_t wifi_event_group;
-#define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
+#include "wire.h"
 
 static const char *WIFI_TAG = "WIFI";
 static const char *UART_TAG = "UART";
 
-static int s_retry_num = 0;
-#define MAX_RETRY 5
+/*
+ * WiFi state. wifi_up is read by uartton_task; everything else is only
+ * touched from the default event loop task (and init_wifi before that).
+ */
+static atomic_bool wifi_up;
+static int wifi_retry_num = 0;
+static esp_timer_handle_t reconnect_timer;
+
+static wifi_config_t wifi_config = {
+    .sta = {
+        .ssid = WIFI_SSID,
+        .password = WIFI_PASSWORD,
+    },
+};
+
+// Last AP connected to, as stored in NVS
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_ap_cache_t;
+
+static wifi_ap_cache_t ap_cache;
+static bool ap_cache_valid;
+
+/*
+ * Reply routing table, keyed by the 4-byte test_id that heads both the
+ * OutMsg requests and the InMsg replies. ntouart_task is the only writer
+ * and uartton_task the only reader, so each entry is guarded by a seqlock
+ * instead of a mutex: the writer makes seq odd while it updates the entry,
+ * and the reader retries if seq was odd or changed under it.
+ */
+typedef struct {
+    atomic_uint seq;
+    uint32_t test_id;
+    uint32_t addr;
+    uint16_t port;
+    TickType_t last_seen;
+    bool v2;                // Sent in a version 2 request, so answer in kind
+    int64_t rx_us;          // When that request reached the bridge
+} session_t;
+
+static session_t sessions[SESSION_TABLE_SIZE];
+static session_t last_session;     // Fallback for replies with unknown test_id
+
+_Static_assert(WIRE_MAX_REQ_SIZE < UDP_BUFFER_SIZE, "a full version 2 request must fit in a slot");
+_Static_assert(WIRE_OUT_MSG_MAX_SIZE <= UDP_BUFFER_SIZE, "an expanded OutMsg must fit in a slot");
+
+/*
+ * Version 2 results waiting to go out together. uartton_task adds the
+ * replies it decodes from one UART event and sends them when the event is
+ * done, or earlier if a reply for another client comes in or it is full.
+ */
+typedef struct {
+    uint8_t buf[WIRE_MAX_REPLY_SIZE];
+    int n;
+    struct sockaddr_in dest;
+} wire_reply_t;
+
+static wire_reply_t wire_reply;
+
+static QueueHandle_t uart_queue;
+
+/*
+ * Per-packet logs are compiled out in the fast setting, leaving only the
+ * counters below, which stats_task prints once per STATS_INTERVAL_MS.
+ */
+#ifdef CONFIG_BRIDGE_LOG_FAST
+#define LOG_PACKET(tag, fmt, ...) do { } while (0)
+#else
+#define LOG_PACKET(tag, fmt, ...) ESP_LOGI(tag, fmt, ##__VA_ARGS__)
+#endif
+
+static atomic_uint ntou_packets;
+static atomic_uint ntou_bytes;
+static atomic_uint uton_packets;
+static atomic_uint uton_bytes;
+
+/*
+ * Time each task spends handling a packet (or UART event), from esp_timer.
+ * Every counter has a single writer task, so plain relaxed loads and stores
+ * suffice; the atomics only keep send_timing() from reading torn values.
+ */
+typedef struct {
+    atomic_uint count;
+    atomic_uint max_us;
+    _Atomic uint64_t busy_us;
+} task_timing_t;
+
+static task_timing_t ntou_timing;
+static task_timing_t utx_timing;
+static task_timing_t uton_timing;
+static task_timing_t fwd_timing;   // Request received to reply sent, by uartton_task
+
+/*
+ * Drops and errors, reported by send_stats(). Like the packet counters,
+ * each one has a single writer task.
+ */
+static atomic_uint too_long_frames;
+static atomic_uint uart_overflows;
+static atomic_uint recv_errors;
+static atomic_uint send_errors;
+static atomic_uint no_client_drops;
+static atomic_uint backlog_drops;
+static atomic_uint backlog_depth;  // Mirror of backlog_count for other tasks
+
+/*
+ * The bridge tasks, kept so stats_task can report how much of its stack
+ * each one has needed.
+ */
+typedef struct {
+    const char *name;
+    uint32_t stack_size;
+    TaskHandle_t handle;
+} bridge_task_t;
+
+enum { TASK_UTX, TASK_NTOU, TASK_UART, TASK_COUNT };
+static bridge_task_t bridge_tasks[TASK_COUNT];
+
+#if defined(CONFIG_BRIDGE_LOG_FAST) || STACK_REPORT_INTERVAL_MS > 0
+#define STATS_TASK 1
+#else
+#define STATS_TASK 0
+#endif
+
+typedef struct {
+    uint8_t buf[UART_BUF_SIZE];
+    int len;
+    bool in_packet;
+    bool escaped;
+} uart_framer_t;
+
+static uart_framer_t uart_framer;
+
+#if UDP_BATCHING
+_Static_assert(UART_BUF_SIZE + 2 <= UDP_BATCH_BUDGET, "a full frame must fit in one batch");
 
-static struct sockaddr_in last_udp_sender;
-static SemaphoreHandle_t sender_mutex;
+// Posted to uart_queue by batch_timer so that uartton_task flushes the batch
+#define UART_BATCH_FLUSH   UART_EVENT_MAX
+
+typedef struct {
+    uint8_t buf[UDP_BATCH_BUDGET];
+    int len;
+    struct sockaddr_in dest;
+} udp_batch_t;
+
+static udp_batch_t udp_batch;
+static esp_timer_handle_t batch_timer;
+#endif
+
+typedef struct {
+    int len;
+    char data[UDP_BUFFER_SIZE];
+} udp_slot_t;
+
+static udp_slot_t udp_slots[UDP_SLOT_COUNT];
+static QueueHandle_t free_slots;
+static QueueHandle_t tx_slots;
+
+#if UDP_BATCHING
+#define UDP_BACKLOG_ENTRY_SIZE UDP_BATCH_BUDGET
+#else
+#define UDP_BACKLOG_ENTRY_SIZE UART_BUF_SIZE
+#endif
+
+// Posted to uart_queue on GOT_IP so that uartton_task sends its backlog
+#define UART_BACKLOG_FLUSH (UART_EVENT_MAX + 1)
+
+/*
+ * Ring of replies held back while WiFi is down. Only uartton_task uses it.
+ */
+typedef struct {
+    struct sockaddr_in dest;
+    int len;
+    uint8_t data[UDP_BACKLOG_ENTRY_SIZE];
+} udp_backlog_entry_t;
+
+static udp_backlog_entry_t udp_backlog[UDP_BACKLOG_COUNT];
+static unsigned backlog_head;
+static unsigned backlog_count;
+static unsigned backlog_dropped;
+
+static void ap_cache_init(wifi_ap_cache_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    strncpy((char *)c->ssid, WIFI_SSID, sizeof(c->ssid));
+}
+
+/*
+ * Load the cached AP, if there is one for the configured SSID.
+ */
+static void ap_cache_load(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+
+    wifi_ap_cache_t c;
+    size_t len = sizeof(c);
+    esp_err_t err = nvs_get_blob(nvs, WIFI_NVS_AP_KEY, &c, &len);
+    nvs_close(nvs);
+
+    wifi_ap_cache_t expected;
+    ap_cache_init(&expected);
+    if (err == ESP_OK && len == sizeof(c) && memcmp(c.ssid, expected.ssid, sizeof(c.ssid)) == 0) {
+        ap_cache = c;
+        ap_cache_valid = true;
+    }
+}
+
+/*
+ * Remember the AP just connected to. Flash is only written when the AP or
+ * its channel has changed.
+ */
+static void ap_cache_store(const wifi_event_sta_connected_t *event)
+{
+    wifi_ap_cache_t c;
+    ap_cache_init(&c);
+    memcpy(c.bssid, event->bssid, sizeof(c.bssid));
+    c.channel = event->channel;
+
+    if (ap_cache_valid && memcmp(&c, &ap_cache, sizeof(c)) == 0) {
+        return;
+    }
+    ap_cache = c;
+    ap_cache_valid = true;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, WIFI_NVS_AP_KEY, &c, sizeof(c));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(WIFI_TAG, "Could not cache AP in NVS (error 0x%x)", err);
+    }
+}
+
+/*
+ * Connect to the cached BSSID on its channel (fast) or scan every channel
+ * for the SSID.
+ */
+static esp_err_t wifi_set_target(bool fast)
+{
+    wifi_config.sta.bssid_set = fast;
+    if (fast) {
+        memcpy(wifi_config.sta.bssid, ap_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = ap_cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    return esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+static void reconnect_timer_cb(void *arg)
+{
+    esp_wifi_connect();
+}
 
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         esp_wifi_connect();
-        ESP_LOGI(WIFI_TAG, "Wifi start: trying to connect...");
+        ESP_LOGI(WIFI_TAG, "Wifi start: trying to connect%s...", ap_cache_valid ? " to cached AP" : "");
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        ap_cache_store((const wifi_event_sta_connected_t *)event_data);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < MAX_RETRY) {
+        const wifi_event_sta_disconnected_t *event = (const wifi_event_sta_disconnected_t *)event_data;
+        atomic_store_explicit(&wifi_up, false, memory_order_release);
+        wifi_retry_num++;
+
+        // Retry the cached AP first; if it keeps failing it may have moved
+        bool fast = ap_cache_valid && wifi_retry_num <= WIFI_FAST_CONNECT_TRIES;
+        if (fast != wifi_config.sta.bssid_set) {
+            wifi_set_target(fast);
+        }
+
+        if (wifi_retry_num == 1) {
             esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGW(WIFI_TAG, "Retrying wifi connection (%d/%d)...", s_retry_num, MAX_RETRY);
+            ESP_LOGW(WIFI_TAG, "Disconnected (reason %d), reconnecting...", event->reason);
         } else {
-            xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
-            ESP_LOGE(WIFI_TAG, "Failed to connect after %d retries", MAX_RETRY);
+            int shift = wifi_retry_num - 2 < 16 ? wifi_retry_num - 2 : 16;
+            uint32_t delay_ms = WIFI_RETRY_MIN_MS << shift;
+            if (delay_ms > WIFI_RETRY_MAX_MS) {
+                delay_ms = WIFI_RETRY_MAX_MS;
+            }
+            esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+            ESP_LOGW(WIFI_TAG, "Connection attempt %d failed (reason %d), retrying in %u ms%s",
+                     wifi_retry_num, event->reason, (unsigned)delay_ms, fast ? " (cached AP)" : "");
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(WIFI_TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
-        xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        wifi_retry_num = 0;
+        atomic_store_explicit(&wifi_up, true, memory_order_release);
+
+        uart_event_t flush = { .type = UART_BACKLOG_FLUSH };
+        xQueueSend(uart_queue, &flush, 0);
     }
 }
 
+/*
+ * Start connecting in the background. The bridge tasks run from boot and
+ * hold back replies until the first GOT_IP.
+ */
 void init_wifi(void)
 {
-    wifi_event_group = xEventGroupCreate();
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect_timer));
+    ap_cache_load();
+
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
     esp_netif_create_default_wifi_sta();
@@ -72,31 +362,12 @@ void init_wifi(void)
                                                         NULL,
                                                         NULL));
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASSWORD,
-        },
-    };
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(wifi_set_target(ap_cache_valid));
     ESP_ERROR_CHECK(esp_wifi_start());
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_POWER_SAVE));
 
-    ESP_LOGI(WIFI_TAG, "Wifi init done. Waiting for IP...");
-
-    EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           portMAX_DELAY);
-
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(WIFI_TAG, "Successfully connected to SSID: %s", WIFI_SSID);
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGE(WIFI_TAG, "Connection to SSID: %s failed", WIFI_SSID);
-    } else {
-        ESP_LOGE(WIFI_TAG, "Unexpected wifi event");
-    }
+    ESP_LOGI(WIFI_TAG, "Wifi init done. Connecting to SSID: %s in the background", WIFI_SSID);
 }
 
 void init_uart(void)
@@ -110,16 +381,267 @@ void init_uart(void)
         .source_clk = UART_SCLK_DEFAULT,
     };
 
-    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, UART_BUF_SIZE * 2, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, UART_BUF_SIZE * 2, UART_TX_BUF_SIZE,
+                                        UART_QUEUE_SIZE, &uart_queue, 0));
     ESP_ERROR_CHECK(uart_param_config(UART_PORT_NUM, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(UART_PORT_NUM, UART_TX_PIN, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
     ESP_LOGI(UART_TAG, "UART2 initialized on TX=%d RX=%d", UART_TX_PIN, UART_RX_PIN);
 }
 
+static void session_write(session_t *s, uint32_t test_id, const struct sockaddr_in *addr,
+                          TickType_t now, bool v2, int64_t rx_us)
+{
+    unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    s->test_id = test_id;
+    s->addr = addr->sin_addr.s_addr;
+    s->port = addr->sin_port;
+    s->last_seen = now;
+    s->v2 = v2;
+    s->rx_us = rx_us;
+
+    atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+static bool session_read(session_t *s, session_t *out)
+{
+    unsigned seq;
+    do {
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq == 0) {
+            return false;
+        }
+        out->test_id = s->test_id;
+        out->addr = s->addr;
+        out->port = s->port;
+        out->last_seen = s->last_seen;
+        out->v2 = s->v2;
+        out->rx_us = s->rx_us;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || atomic_load_explicit(&s->seq, memory_order_relaxed) != seq);
+
+    return true;
+}
+
+static bool session_stale(TickType_t last_seen, TickType_t now)
+{
+    return (TickType_t)(now - last_seen) > pdMS_TO_TICKS(SESSION_TTL_MS);
+}
+
+/*
+ * Remember which address sent test_id, and how. Called only from
+ * ntouart_task.
+ */
+static void session_add(uint32_t test_id, const struct sockaddr_in *src, TickType_t now,
+                        bool v2, int64_t rx_us)
+{
+    // As the only writer, this task may read entries without the seqlock.
+    // Reuse the entry for test_id if present, else a free or aged-out one,
+    // else evict the least recently used entry in the probe window.
+    session_t *victim = NULL;
+    bool victim_free = false;
+    for (int i = 0; i < SESSION_PROBE; ++i) {
+        session_t *s = &sessions[(test_id + i) & (SESSION_TABLE_SIZE - 1)];
+        bool used = atomic_load_explicit(&s->seq, memory_order_relaxed) != 0;
+
+        if (used && s->test_id == test_id) {
+            victim = s;
+            break;
+        }
+        if (!used || session_stale(s->last_seen, now)) {
+            if (!victim_free) {
+                victim = s;
+                victim_free = true;
+            }
+        } else if (victim == NULL ||
+                   (!victim_free && (TickType_t)(now - s->last_seen) > (TickType_t)(now - victim->last_seen))) {
+            victim = s;
+        }
+    }
+
+    session_write(victim, test_id, src, now, v2, rx_us);
+}
+
+/*
+ * Find the session of the request a reply belongs to. Replies with an
+ * unknown or aged-out test_id go to the most recent sender, in the
+ * version 1 format.
+ */
+static bool session_lookup(const uint8_t *data, int len, session_t *entry, struct sockaddr_in *dest)
+{
+    bool found = false;
+
+    if (len >= (int)sizeof(uint32_t)) {
+        uint32_t test_id = wire_get_u32(data);
+        TickType_t now = xTaskGetTickCount();
+
+        for (int i = 0; i < SESSION_PROBE && !found; ++i) {
+            session_t *s = &sessions[(test_id + i) & (SESSION_TABLE_SIZE - 1)];
+            found = session_read(s, entry) && entry->test_id == test_id &&
+                    !session_stale(entry->last_seen, now);
+        }
+    }
+
+    if (!found && !session_read(&last_session, entry)) {
+        return false;
+    }
+
+    memset(dest, 0, sizeof(*dest));
+    dest->sin_family = AF_INET;
+    dest->sin_addr.s_addr = entry->addr;
+    dest->sin_port = entry->port;
+    return true;
+}
+
+static void timing_record(task_timing_t *t, uint32_t us)
+{
+    atomic_store_explicit(&t->count, atomic_load_explicit(&t->count, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&t->busy_us, atomic_load_explicit(&t->busy_us, memory_order_relaxed) + us,
+                          memory_order_relaxed);
+    if (us > atomic_load_explicit(&t->max_us, memory_order_relaxed)) {
+        atomic_store_explicit(&t->max_us, us, memory_order_relaxed);
+    }
+}
+
+static void timing_add(task_timing_t *t, int64_t start_us)
+{
+    timing_record(t, (uint32_t)(esp_timer_get_time() - start_us));
+}
+
+/*
+ * Reply layout: see TIMING_TEST_ID in wire.h.
+ */
+static void send_timing(int sock, const struct sockaddr_in *dest)
+{
+    uint8_t reply[TIMING_REPLY_SIZE];
+    size_t pos = 0;
+
+    wire_put_u32(&reply[pos], TIMING_TEST_ID);
+    pos += 4;
+
+    const task_timing_t *tasks[] = {&ntou_timing, &utx_timing, &uton_timing};
+    for (int i = 0; i < 3; ++i) {
+        uint32_t count = atomic_load_explicit(&tasks[i]->count, memory_order_relaxed);
+        uint32_t max_us = atomic_load_explicit(&tasks[i]->max_us, memory_order_relaxed);
+        uint64_t busy_us = atomic_load_explicit(&tasks[i]->busy_us, memory_order_relaxed);
+        wire_put_u32(&reply[pos], count);
+        wire_put_u32(&reply[pos + 4], max_us);
+        wire_put_u64(&reply[pos + 8], busy_us);
+        pos += 16;
+    }
+
+    wire_put_u64(&reply[pos], (uint64_t)esp_timer_get_time());
+
+    if (sendto(sock, reply, sizeof(reply), 0, (const struct sockaddr *)dest, sizeof(*dest)) < 0) {
+        ESP_LOGE("NTOUART", "Failed to send timing reply");
+    }
+}
+
+/*
+ * Reply layout: see wire_put_stats() in wire.h. Counters are read one at a
+ * time without stopping the other tasks, so they may be a packet apart.
+ */
+static void send_stats(int sock, const struct sockaddr_in *dest)
+{
+    wire_stats_t stats = {
+        .uptime_us = (uint64_t)esp_timer_get_time(),
+        .udp_rx_packets = atomic_load_explicit(&ntou_packets, memory_order_relaxed),
+        .udp_rx_bytes = atomic_load_explicit(&ntou_bytes, memory_order_relaxed),
+        .udp_tx_packets = atomic_load_explicit(&uton_packets, memory_order_relaxed),
+        .udp_tx_bytes = atomic_load_explicit(&uton_bytes, memory_order_relaxed),
+        .too_long = atomic_load_explicit(&too_long_frames, memory_order_relaxed),
+        .uart_overflows = atomic_load_explicit(&uart_overflows, memory_order_relaxed),
+        .recv_errors = atomic_load_explicit(&recv_errors, memory_order_relaxed),
+        .send_errors = atomic_load_explicit(&send_errors, memory_order_relaxed),
+        .no_client = atomic_load_explicit(&no_client_drops, memory_order_relaxed),
+        .backlog_dropped = atomic_load_explicit(&backlog_drops, memory_order_relaxed),
+        .tx_queue = (uint16_t)uxQueueMessagesWaiting(tx_slots),
+        .uart_queue = (uint16_t)uxQueueMessagesWaiting(uart_queue),
+        .backlog = (uint16_t)atomic_load_explicit(&backlog_depth, memory_order_relaxed),
+        .fwd_count = atomic_load_explicit(&fwd_timing.count, memory_order_relaxed),
+        .fwd_max_us = atomic_load_explicit(&fwd_timing.max_us, memory_order_relaxed),
+        .fwd_total_us = atomic_load_explicit(&fwd_timing.busy_us, memory_order_relaxed),
+    };
+
+    const int tasks[] = {TASK_NTOU, TASK_UTX, TASK_UART};
+    for (int i = 0; i < 3; ++i) {
+        TaskHandle_t handle = bridge_tasks[tasks[i]].handle;
+        stats.stack_free[i] = handle ? uxTaskGetStackHighWaterMark(handle) : 0;
+    }
+
+    uint8_t reply[STATS_REPLY_SIZE];
+    wire_put_stats(reply, &stats);
+    if (sendto(sock, reply, sizeof(reply), 0, (const struct sockaddr *)dest, sizeof(*dest)) < 0) {
+        ESP_LOGE("NTOUART", "Failed to send stats reply");
+    }
+}
+
+void init_slots(void)
+{
+    free_slots = xQueueCreate(UDP_SLOT_COUNT, sizeof(udp_slot_t *));
+    tx_slots = xQueueCreate(UDP_SLOT_COUNT, sizeof(udp_slot_t *));
+    if (free_slots == NULL || tx_slots == NULL) {
+        ESP_LOGE("MAIN", "Failed to create slot queues!");
+        abort();
+    }
+
+    for (int i = 0; i < UDP_SLOT_COUNT; ++i) {
+        udp_slot_t *slot = &udp_slots[i];
+        xQueueSend(free_slots, &slot, 0);
+    }
+}
+
+/*
+ * Split a version 2 request into version 1 OutMsgs for the STM32, packed
+ * into as few slots as they fit in, and register a session for each of its
+ * tests first. Takes the slot holding the request and returns the one to
+ * receive the next datagram into, or NULL if all were handed to
+ * uart_tx_task. Called only from ntouart_task.
+ */
+static udp_slot_t *expand_request(udp_slot_t *slot, int len, const struct sockaddr_in *src,
+                                  TickType_t now, int64_t rx_us)
+{
+    static uint8_t req[UDP_BUFFER_SIZE];
+
+    int n_tests = wire_check_req(slot->data, len);
+    if (n_tests < 0) {
+        ESP_LOGW("NTOUART", "Malformed version 2 request of %d bytes. Dropping.", len);
+        return slot;
+    }
+
+    // The request's slot is reused for the first OutMsgs
+    memcpy(req, slot->data, len);
+    uint8_t p_len;
+    const uint8_t *payload = wire_get_req_payload(req, &p_len);
+    int msg_size = WIRE_OUT_MSG_HDR_SIZE + p_len;
+
+    slot->len = 0;
+    for (int i = 0; i < n_tests; ++i) {
+        if (slot == NULL) {
+            xQueueReceive(free_slots, &slot, portMAX_DELAY);
+            slot->len = 0;
+        }
+
+        wire_test_t t = wire_get_req_test(req, i);
+        session_add(t.test_id, src, now, true, rx_us);
+        slot->len += wire_put_out_msg(&slot->data[slot->len], t.test_id, t.peripheral, t.value,
+                                      payload, p_len);
+
+        if (i == n_tests - 1 || slot->len + msg_size > (int)sizeof(slot->data)) {
+            xQueueSend(tx_slots, &slot, portMAX_DELAY);
+            slot = NULL;
+        }
+    }
+
+    return slot;
+}
+
 void ntouart_task(void *arg)
 {
-    char rx_buf[UDP_BUFFER_SIZE];
     struct sockaddr_in listen_addr = {
         .sin_family = AF_INET,
         .sin_port = htons(UDP_PORT),
@@ -140,41 +662,392 @@ void ntouart_task(void *arg)
 
     ESP_LOGI("NTOUART", "Listening for UDP packets on port %d", UDP_PORT);
 
+    udp_slot_t *slot = NULL;
+
     while (1) {
+        if (slot == NULL) {
+            xQueueReceive(free_slots, &slot, portMAX_DELAY);
+        }
+
         struct sockaddr_in source_addr;
         socklen_t socklen = sizeof(source_addr);
-        int len = recvfrom(sock, rx_buf, sizeof(rx_buf) - 1, 0,
+        int len = recvfrom(sock, slot->data, sizeof(slot->data) - 1, 0,
                            (struct sockaddr *)&source_addr, &socklen);
 
         if (len < 0) {
             ESP_LOGE("NTOUART", "recvfrom failed");
+            atomic_fetch_add_explicit(&recv_errors, 1, memory_order_relaxed);
+            continue;
+        }
+        int64_t start_us = esp_timer_get_time();
+
+        uint32_t test_id = len >= 4 ? wire_get_u32(slot->data) : 0;
+        if (len == 4 && test_id == TIMING_TEST_ID) {
+            send_timing(sock, &source_addr);
+            continue;
+        }
+        if (len == 4 && test_id == STATS_TEST_ID) {
+            send_stats(sock, &source_addr);
+            continue;
+        }
+
+        TickType_t now = xTaskGetTickCount();
+        session_write(&last_session, 0, &source_addr, now, false, 0);
+
+        if (len >= 4 && test_id == WIRE_V2_ID) {
+            slot = expand_request(slot, len, &source_addr, now, start_us);
+            atomic_fetch_add_explicit(&ntou_packets, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&ntou_bytes, len, memory_order_relaxed);
+            timing_add(&ntou_timing, start_us);
+            LOG_PACKET("NTOUART", "Received %d-byte version 2 request from %s:%d",
+                     len,
+                     inet_ntoa(source_addr.sin_addr),
+                     ntohs(source_addr.sin_port));
             continue;
         }
 
-        xSemaphoreTake(sender_mutex, portMAX_DELAY);
-        memcpy(&last_udp_sender, &source_addr, sizeof(source_addr));
-        xSemaphoreGive(sender_mutex);
+        if (len >= 4) {
+            session_add(test_id, &source_addr, now, false, start_us);
+        }
+
+        // Hand the datagram to uart_tx_task by pointer. Only this task
+        // writes into slots, so the payload is safe to log until the next
+        // free slot is taken.
+        slot->len = len;
+        slot->data[len] = '\0';
+        udp_slot_t *sent = slot;
+        slot = NULL;
+        xQueueSend(tx_slots, &sent, portMAX_DELAY);
 
-        uart_write_bytes(UART_PORT_NUM, rx_buf, len);
+        atomic_fetch_add_explicit(&ntou_packets, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ntou_bytes, len, memory_order_relaxed);
+        timing_add(&ntou_timing, start_us);
 
-        rx_buf[len] = '\0';
-        ESP_LOGI("NTOUART", "Received %d bytes from %s:%d: %s",
+        LOG_PACKET("NTOUART", "Received %d bytes from %s:%d: %s",
                  len,
                  inet_ntoa(source_addr.sin_addr),
                  ntohs(source_addr.sin_port),
-                 rx_buf);
+                 sent->data);
     }
 
     close(sock);
     vTaskDelete(NULL);
 }
 
+void uart_tx_task(void *arg)
+{
+    udp_slot_t *slot;
+
+    while (1) {
+        if (xQueueReceive(tx_slots, &slot, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        int64_t start_us = esp_timer_get_time();
+        uart_write_bytes(UART_PORT_NUM, slot->data, slot->len);
+        timing_add(&utx_timing, start_us);
+        xQueueSend(free_slots, &slot, portMAX_DELAY);
+    }
+
+    vTaskDelete(NULL);
+}
+
+static void backlog_push(const uint8_t *data, int len, const struct sockaddr_in *dest)
+{
+    if (backlog_count == UDP_BACKLOG_COUNT) {
+        backlog_head = (backlog_head + 1) % UDP_BACKLOG_COUNT;
+        backlog_count--;
+        backlog_dropped++;
+        atomic_fetch_add_explicit(&backlog_drops, 1, memory_order_relaxed);
+    }
+
+    udp_backlog_entry_t *e = &udp_backlog[(backlog_head + backlog_count) % UDP_BACKLOG_COUNT];
+    e->dest = *dest;
+    e->len = len;
+    memcpy(e->data, data, len);
+    backlog_count++;
+    atomic_store_explicit(&backlog_depth, backlog_count, memory_order_relaxed);
+}
+
+static bool udp_transmit(int sock, const uint8_t *data, int len, const struct sockaddr_in *dest)
+{
+    int sent = sendto(sock, data, len, 0, (const struct sockaddr *)dest, sizeof(*dest));
+    if (sent > 0) {
+        atomic_fetch_add_explicit(&uton_packets, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&uton_bytes, sent, memory_order_relaxed);
+    } else if (sent < 0) {
+        atomic_fetch_add_explicit(&send_errors, 1, memory_order_relaxed);
+    }
+
+    LOG_PACKET("UARTTON", "Forwarded %d bytes from UART to %s:%d",
+             sent, UDP_SOURCE_IP, UDP_PORT);
+    return sent >= 0;
+}
+
+/*
+ * Send the replies held back during a reconnect, oldest first. Stops early
+ * if the link drops again.
+ */
+static void backlog_flush(int sock)
+{
+    if (backlog_count == 0) {
+        return;
+    }
+    ESP_LOGI("UARTTON", "Sending %u replies held during reconnect (%u dropped)",
+             backlog_count, backlog_dropped);
+    backlog_dropped = 0;
+
+    while (backlog_count > 0 && atomic_load_explicit(&wifi_up, memory_order_acquire)) {
+        udp_backlog_entry_t *e = &udp_backlog[backlog_head];
+        if (!udp_transmit(sock, e->data, e->len, &e->dest) &&
+            !atomic_load_explicit(&wifi_up, memory_order_acquire)) {
+            break;
+        }
+        backlog_head = (backlog_head + 1) % UDP_BACKLOG_COUNT;
+        backlog_count--;
+    }
+    atomic_store_explicit(&backlog_depth, backlog_count, memory_order_relaxed);
+}
+
+static void udp_send(int sock, const uint8_t *data, int len, const struct sockaddr_in *dest)
+{
+    if (!atomic_load_explicit(&wifi_up, memory_order_acquire)) {
+        backlog_push(data, len, dest);
+        return;
+    }
+
+    backlog_flush(sock);
+    if (!udp_transmit(sock, data, len, dest) && !atomic_load_explicit(&wifi_up, memory_order_acquire)) {
+        // The link went down under us
+        backlog_push(data, len, dest);
+    }
+}
+
+#if UDP_BATCHING
+static void batch_timer_cb(void *arg)
+{
+    uart_event_t event = { .type = UART_BATCH_FLUSH };
+    xQueueSend(uart_queue, &event, 0);
+}
+
+void init_batching(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = batch_timer_cb,
+        .name = "udp_batch",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &batch_timer));
+}
+
+static void batch_flush(int sock)
+{
+    if (udp_batch.len == 0) {
+        return;
+    }
+
+    esp_timer_stop(batch_timer);
+    udp_send(sock, udp_batch.buf, udp_batch.len, &udp_batch.dest);
+    udp_batch.len = 0;
+}
+
+#endif
+
+static bool same_dest(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static void emit_datagram(int sock, const uint8_t *data, int len, const struct sockaddr_in *dest)
+{
+#if UDP_BATCHING
+    // A stale flush event from an earlier batch may flush this one early,
+    // which only costs a smaller datagram.
+    if (udp_batch.len > 0 &&
+        (!same_dest(&udp_batch.dest, dest) || udp_batch.len + 2 + len > UDP_BATCH_BUDGET)) {
+        batch_flush(sock);
+    }
+
+    if (udp_batch.len == 0) {
+        udp_batch.dest = *dest;
+        esp_timer_start_once(batch_timer, UDP_BATCH_WINDOW_US);
+    }
+
+    udp_batch.buf[udp_batch.len++] = len & 0xff;
+    udp_batch.buf[udp_batch.len++] = (len >> 8) & 0xff;
+    memcpy(&udp_batch.buf[udp_batch.len], data, len);
+    udp_batch.len += len;
+#else
+    udp_send(sock, data, len, dest);
+#endif
+}
+
+static void wire_reply_flush(int sock)
+{
+    if (wire_reply.n == 0) {
+        return;
+    }
+
+    wire_put_reply_hdr(wire_reply.buf, wire_reply.n);
+    emit_datagram(sock, wire_reply.buf, WIRE_REPLY_HDR_SIZE + wire_reply.n * WIRE_RESULT_SIZE,
+                  &wire_reply.dest);
+    wire_reply.n = 0;
+}
+
+static void forward_packet(int sock, const uint8_t *data, int len)
+{
+    session_t entry;
+    struct sockaddr_in dest;
+    if (!session_lookup(data, len, &entry, &dest)) {
+        ESP_LOGW("UARTTON", "No UDP client to forward %d bytes to. Dropping.", len);
+        atomic_fetch_add_explicit(&no_client_drops, 1, memory_order_relaxed);
+        return;
+    }
+
+    // The fallback session has no request time
+    if (entry.rx_us != 0) {
+        timing_record(&fwd_timing, (uint32_t)(esp_timer_get_time() - entry.rx_us));
+    }
+
+    if (!entry.v2 || len != WIRE_IN_MSG_SIZE) {
+        emit_datagram(sock, data, len, &dest);
+        return;
+    }
+
+    if (wire_reply.n > 0 && (!same_dest(&wire_reply.dest, &dest) || wire_reply.n == WIRE_MAX_RESULTS)) {
+        wire_reply_flush(sock);
+    }
+
+    wire_test_t result = wire_get_in_msg(data);
+    result.bridge_us = (uint32_t)(esp_timer_get_time() - entry.rx_us);
+    wire_reply.dest = dest;
+    wire_put_result(wire_reply.buf, wire_reply.n++, &result);
+}
+
+static void uart_framer_reset(uart_framer_t *f)
+{
+    f->in_packet = false;
+    f->escaped = false;
+    f->len = 0;
+}
+
+#if UART_FRAMING == UART_FRAMING_STUFFED
+/*
+ * Decode a chunk of byte-stuffed UART input in one pass. START_BYTE never
+ * appears unescaped inside a body, so it always begins a new frame, and an
+ * escape directly followed by END_BYTE aborts the frame.
+ */
+static void uart_framer_feed(uart_framer_t *f, const uint8_t *data, int len, int sock)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+
+    while (p < end)
+    {
+        if (!f->in_packet)
+        {
+            const uint8_t *start = memchr(p, START_BYTE, end - p);
+            if (start == NULL)
+            {
+                return;
+            }
+            uart_framer_reset(f);
+            f->in_packet = true;
+            p = start + 1;
+            continue;
+        }
+
+        uint8_t byte = *p++;
+
+        if (byte == START_BYTE)
+        {
+            if (f->len > 0)
+            {
+                ESP_LOGW("UARTTON", "Unterminated frame: %d bytes. Dropping.", f->len);
+            }
+            uart_framer_reset(f);
+            f->in_packet = true;
+        }
+        else if (byte == END_BYTE)
+        {
+            if (!f->escaped)
+            {
+                forward_packet(sock, f->buf, f->len);
+            }
+            uart_framer_reset(f);
+        }
+        else if (byte == ESC_BYTE)
+        {
+            f->escaped = true;
+        }
+        else if (f->len < UART_BUF_SIZE)
+        {
+            f->buf[f->len++] = f->escaped ? (byte ^ ESC_XOR) : byte;
+            f->escaped = false;
+        }
+        else
+        {
+            ESP_LOGE("UARTTON", "Packet too long: %d bytes. Dropping.", f->len);
+            atomic_fetch_add_explicit(&too_long_frames, 1, memory_order_relaxed);
+            uart_framer_reset(f);
+        }
+    }
+}
+#else
+/*
+ * Scan a chunk of UART bytes for START_BYTE/END_BYTE frames in one pass.
+ * Frame state lives in the framer, so a frame may span several chunks.
+ */
+static void uart_framer_feed(uart_framer_t *f, const uint8_t *data, int len, int sock)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+
+    while (p < end)
+    {
+        if (!f->in_packet)
+        {
+            const uint8_t *start = memchr(p, START_BYTE, end - p);
+            if (start == NULL)
+            {
+                return;
+            }
+            uart_framer_reset(f);
+            f->in_packet = true;
+            p = start + 1;
+            continue;
+        }
+
+        const uint8_t *stop = memchr(p, END_BYTE, end - p);
+        int n = (stop ? stop : end) - p;
+
+        if (f->len + n > UART_BUF_SIZE)
+        {
+            ESP_LOGE("UARTTON", "Packet too long: %d bytes. Dropping.", f->len + n);
+            atomic_fetch_add_explicit(&too_long_frames, 1, memory_order_relaxed);
+            uart_framer_reset(f);
+            p = stop ? stop + 1 : end;
+            continue;
+        }
+
+        memcpy(&f->buf[f->len], p, n);
+        f->len += n;
+
+        if (stop == NULL)
+        {
+            return;
+        }
+
+        forward_packet(sock, f->buf, f->len);
+        uart_framer_reset(f);
+        p = stop + 1;
+    }
+}
+#endif
+
 void uartton_task(void *arg)
 {
-    uint8_t rx_buf[UART_BUF_SIZE];
-    uint8_t byte;
-    int packet_len = 0;
-    bool in_packet = false;
+    static uint8_t chunk[UART_READ_CHUNK];
+    uart_event_t event;
 
     int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
     if (sock < 0) {
@@ -186,68 +1059,163 @@ void uartton_task(void *arg)
 
     while (1)
     {
-        int len = uart_read_bytes(UART_PORT_NUM, &byte, 1, pdMS_TO_TICKS(10));
+        if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+        int64_t start_us = esp_timer_get_time();
 
-        if (len > 0)
+        switch ((int)event.type)   // Also carries the bridge's own events
         {
-            if (!in_packet)
-            {
-                if (byte == START_BYTE)
-                {
-                    packet_len = 0;
-                    in_packet = true;
-                }
-            }
-            else
+            case UART_DATA:
             {
-                if (byte == END_BYTE)
-                {
-                    struct sockaddr_in dest;
-                    xSemaphoreTake(sender_mutex, portMAX_DELAY);
-                    memcpy(&dest, &last_udp_sender, sizeof(dest));
-                    xSemaphoreGive(sender_mutex);
-
-                    int sent = sendto(sock, rx_buf, packet_len, 0, (struct sockaddr *)&dest, sizeof(dest));
-                    ESP_LOGI("UARTTON", "Forwarded %d bytes from UART to %s:%d",
-                             sent, UDP_SOURCE_IP, UDP_PORT);
+                size_t buffered = 0;
+                uart_get_buffered_data_len(UART_PORT_NUM, &buffered);
 
-                    in_packet = false;
-                    packet_len = 0;
-                }
-                else
+                while (buffered > 0)
                 {
-                    if (packet_len < UART_BUF_SIZE)
-                    {
-                        rx_buf[packet_len++] = byte;
-                    }
-                    else
+                    size_t want = buffered < sizeof(chunk) ? buffered : sizeof(chunk);
+                    int len = uart_read_bytes(UART_PORT_NUM, chunk, want, 0);
+                    if (len <= 0)
                     {
-                        ESP_LOGE("UARTTON", "Packet too long: %d bytes. Dropping.", packet_len);
-                        in_packet = false;
-                        packet_len = 0;
+                        break;
                     }
+                    uart_framer_feed(&uart_framer, chunk, len, sock);
+                    buffered -= len;
                 }
+                wire_reply_flush(sock);
+                break;
             }
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                ESP_LOGW("UARTTON", "UART overflow (event %d). Flushing input.", event.type);
+                atomic_fetch_add_explicit(&uart_overflows, 1, memory_order_relaxed);
+                uart_flush_input(UART_PORT_NUM);
+                xQueueReset(uart_queue);
+                uart_framer_reset(&uart_framer);
+                wire_reply_flush(sock);
+#if UDP_BATCHING
+                batch_flush(sock);
+#endif
+                break;
+
+#if UDP_BATCHING
+            case UART_BATCH_FLUSH:
+                batch_flush(sock);
+                break;
+#endif
+
+            case UART_BACKLOG_FLUSH:
+                backlog_flush(sock);
+                break;
+
+            default:
+                break;
         }
+        timing_add(&uton_timing, start_us);
     }
 
     close(sock);
     vTaskDelete(NULL);
 }
 
+#if STACK_REPORT_INTERVAL_MS > 0
+/*
+ * uxTaskGetStackHighWaterMark() gives the least free stack a task has had
+ * since it started, in bytes on ESP-IDF.
+ */
+static void log_stack_usage(void)
+{
+    for (int i = 0; i < TASK_COUNT; ++i) {
+        const bridge_task_t *t = &bridge_tasks[i];
+        if (t->handle == NULL) {
+            continue;
+        }
+        unsigned free_bytes = uxTaskGetStackHighWaterMark(t->handle);
+        ESP_LOGI("STACK", "%s: used at most %u of %u bytes",
+                 t->name, (unsigned)(t->stack_size - free_bytes), (unsigned)t->stack_size);
+    }
+}
+#endif
+
+#if STATS_TASK
+void stats_task(void *arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+#ifdef CONFIG_BRIDGE_LOG_FAST
+    unsigned last_ntou = 0, last_uton = 0;
+    const TickType_t period = pdMS_TO_TICKS(STATS_INTERVAL_MS);
+#else
+    const TickType_t period = pdMS_TO_TICKS(STACK_REPORT_INTERVAL_MS);
+#endif
+#if STACK_REPORT_INTERVAL_MS > 0
+    TickType_t last_report = last_wake;
+#endif
+
+    while (1)
+    {
+        vTaskDelayUntil(&last_wake, period);
+
+#ifdef CONFIG_BRIDGE_LOG_FAST
+        unsigned ntou = atomic_load_explicit(&ntou_packets, memory_order_relaxed);
+        unsigned uton = atomic_load_explicit(&uton_packets, memory_order_relaxed);
+
+        ESP_LOGI("STATS", "UDP->UART: %u pkts (+%u), %u bytes | UART->UDP: %u pkts (+%u), %u bytes",
+                 ntou, ntou - last_ntou,
+                 atomic_load_explicit(&ntou_bytes, memory_order_relaxed),
+                 uton, uton - last_uton,
+                 atomic_load_explicit(&uton_bytes, memory_order_relaxed));
+
+        last_ntou = ntou;
+        last_uton = uton;
+#endif
+
+#if STACK_REPORT_INTERVAL_MS > 0
+        if ((TickType_t)(last_wake - last_report) >= pdMS_TO_TICKS(STACK_REPORT_INTERVAL_MS)) {
+            last_report = last_wake;
+            log_stack_usage();
+        }
+#endif
+    }
+}
+#endif
+
+static void start_task(int id, TaskFunction_t fn, const char *name, uint32_t stack_size,
+                       UBaseType_t priority, BaseType_t core)
+{
+    bridge_task_t *t = &bridge_tasks[id];
+    t->name = name;
+    t->stack_size = stack_size;
+
+    if (xTaskCreatePinnedToCore(fn, name, stack_size, NULL, priority, &t->handle, core) != pdPASS) {
+        ESP_LOGE("TASK", "Failed to start %s", name);
+        t->handle = NULL;
+        return;
+    }
+    ESP_LOGI("TASK", "%s: core %d, priority %u, %u byte stack",
+             name, (int)core, (unsigned)priority, (unsigned)stack_size);
+}
+
 
 void app_main(void)
 {
     ESP_ERROR_CHECK(nvs_flash_init());
+    init_uart();        // Before WiFi: GOT_IP posts to uart_queue
     init_wifi();
-    init_uart();
 
-    sender_mutex = xSemaphoreCreateMutex();
-    if (sender_mutex == NULL) {
-        ESP_LOGE("MAIN", "Failed to create sender_mutex!");
-        abort();
-    }
+    init_slots();
+#if UDP_BATCHING
+    init_batching();
+#endif
 
-    xTaskCreate(ntouart_task, "ntouart_task", TASK_STACK_SIZE, NULL, TASK_PRIORITY_NTOU, NULL);
-    xTaskCreate(uartton_task, "uartton_task", TASK_STACK_SIZE, NULL, TASK_PRIORITY_UART, NULL);
+    // UART stages get a core of their own; the UDP receive stage stays
+    // next to the WiFi task that hands it packets
+    start_task(TASK_UTX, uart_tx_task, "uart_tx_task", TASK_STACK_UTX, TASK_PRIORITY_UTX, TASK_CORE_UART);
+    start_task(TASK_NTOU, ntouart_task, "ntouart_task", TASK_STACK_NTOU, TASK_PRIORITY_NTOU, TASK_CORE_NET);
+    start_task(TASK_UART, uartton_task, "uartton_task", TASK_STACK_UART, TASK_PRIORITY_UART, TASK_CORE_UART);
+#if STATS_TASK
+    xTaskCreatePinnedToCore(stats_task, "stats_task", TASK_STACK_STATS, NULL, TASK_PRIORITY_STATS, NULL,
+                            tskNO_AFFINITY);
+#endif
 }